@@ -14,69 +14,595 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HTTP_CROSS_ORIGIN_SSE2)
+#include <emmintrin.h>
+#endif
+
 
 #define SPACE ' '
 #define COMMA ','
 
+#define MAX_ORIGIN_LEN  512
+
+#define MAX_REQUEST_HEADERS  4
+
+#define MAX_HEADER_NAME_LEN  256
+
+/* The token spans collected on the stack by one call of the splitter */
+#define MAX_SPLIT_TOKENS     16
+
+/* The request header names a response of this module varies on */
+#define MAX_VARY_NAMES       3
+
+/*
+ * The origin index built by util/cors-origin-index.pl: the header, the
+ * slots of an open addressing hash table and the arena of the lowercased
+ * origins. All the numbers are 32 bits in the byte order of the host.
+ */
+#define ORIGIN_INDEX_MAGIC       "CORSIDX1"
+#define ORIGIN_INDEX_BYTE_ORDER  0x01020304
+
+typedef struct {
+    u_char                     magic[8];
+    uint32_t                   byte_order;
+    uint32_t                   nslots;
+    uint32_t                   nentries;
+    uint32_t                   arena_size;
+} ngx_http_cross_origin_index_header_t;
+
+/* An empty slot has zero length */
+typedef struct {
+    uint32_t                   hash;
+    uint32_t                   offset;
+    uint32_t                   len;
+} ngx_http_cross_origin_index_slot_t;
+
+typedef struct {
+    ngx_str_t                  path;
+    u_char                    *start;
+    size_t                     size;
+    ngx_http_cross_origin_index_slot_t  *slots;
+    uint32_t                   mask;
+    u_char                    *arena;
+    uint32_t                   arena_size;
+} ngx_http_cross_origin_index_t;
+
+/*
+ * A set of origins in a shared memory zone, with the layout of the
+ * index. A writer builds a new set and publishes it by swapping the
+ * current pointer with the mutex of the zone locked, so the readers never
+ * lock. Every process notes the generation it searches under in its slot
+ * of readers, and a replaced set is freed once no process searches under
+ * a generation older than the one that replaced it.
+ */
+typedef struct ngx_http_cross_origin_set_s  ngx_http_cross_origin_set_t;
+
+struct ngx_http_cross_origin_set_s {
+    ngx_http_cross_origin_index_t  index;
+    size_t                     size;
+    ngx_uint_t                 nentries;
+    ngx_uint_t                 generation;
+
+    /* the generation that replaced the set */
+    ngx_uint_t                 retired;
+    ngx_http_cross_origin_set_t  *next;
+};
+
+typedef struct {
+    /* ngx_http_cross_origin_set_t * */
+    ngx_atomic_t               current;
+    ngx_http_cross_origin_set_t  *retired;
+
+    /* the generation of the current set, stored after the swap */
+    ngx_atomic_t               generation;
+
+    /* the generation searched under plus one by ngx_process_slot, or 0 */
+    ngx_atomic_t               readers[NGX_MAX_PROCESSES];
+} ngx_http_cross_origin_sets_t;
+
+/* The origins of cors_origin_file, checked by a timer of the workers */
+#define ORIGIN_FILE_INTERVAL  5
+#define ORIGIN_FILE_SIZE      (1024 * 1024)
+
+typedef struct {
+    ngx_http_cross_origin_sets_t  sets;
+    time_t                     next_check;
+    time_t                     mtime;
+    off_t                      size;
+    ngx_file_uniq_t            uniq;
+} ngx_http_cross_origin_file_sh_t;
 
 typedef struct {
-    u_char    *name;
-    uint32_t   method;
-} ngx_http_corss_origin_method_name_t;
+    ngx_http_cross_origin_file_sh_t  *sh;
+    ngx_slab_pool_t           *shpool;
+    ngx_str_t                  path;
+    time_t                     interval;
+    ngx_event_t                event;
+} ngx_http_cross_origin_file_t;
+
+/* The origins of cors_origin_zone, changed by the requests of cors_api */
+typedef struct {
+    ngx_http_cross_origin_sets_t  *sh;
+    ngx_slab_pool_t           *shpool;
+    ngx_flag_t                 defined;
+} ngx_http_cross_origin_zone_t;
+
+/* The Access-Control-Request-Headers values remembered by a connection */
+#define MAX_MEMO_HEADERS_LEN  512
+
+/* The bit of the field names not found in the configured headers */
+#define UNKNOWN_HEADER_BIT   ((uint64_t) 1 << 63)
+#define MAX_HEADER_BITS      63
+
 
 typedef struct ngx_http_cross_origin_val_s {
     ngx_uint_t                 hash;
     ngx_str_t                  value;
 } ngx_http_cross_origin_val_t;
 
+/* The scheme and port of a wildcard origin with the host "*.foo.com" */
+typedef struct {
+    ngx_str_t                  scheme;
+    ngx_str_t                  port;
+} ngx_http_cross_origin_wildcard_t;
+
+typedef struct {
+    ngx_str_t                  host;
+    ngx_array_t               *origins; /* ngx_http_cross_origin_wildcard_t */
+} ngx_http_cross_origin_wildcard_host_t;
+
+/* An entry of cors_origin_cidr, the port range is 0-65535 for any port */
 typedef struct {
-    ngx_flag_t  preflight;
+    ngx_str_t                  scheme;
+    ngx_cidr_t                 cidr;
+    ngx_uint_t                 port_min;
+    ngx_uint_t                 port_max;
+} ngx_http_cross_origin_cidr_t;
+
+/*
+ * The value of a network is the array of the pointers to all the entries
+ * of its own and of the shorter networks containing it, so the longest
+ * match of the radix tree is enough.
+ */
+typedef struct {
+    ngx_radix_tree_t          *tree;
+#if (NGX_HAVE_INET6)
+    ngx_radix_tree_t          *tree6;
+#endif
+} ngx_http_cross_origin_cidrs_t;
+
+typedef struct {
+    ngx_hash_combined_t        hash;
+#if (NGX_PCRE)
+    ngx_regex_t               *regex;
+    ngx_regex_t               *regex_caseless;
+
+    /* ngx_regex_t *, the patterns with back references, matched alone */
+    ngx_array_t               *regexes;
+#endif
+} ngx_http_cross_origin_origins_t;
+
+/*
+ * Each simple or configured header field name has a bit, the lowercased
+ * names are hashed to their bits. The configured names past the last bit
+ * share it, a request only needs them to be allowed.
+ */
+typedef struct {
+    ngx_hash_t                 hash;
+    uint64_t                   allowed;
+    uint64_t                   simple;
+} ngx_http_cross_origin_headers_t;
+
+/* The CORS request headers, collected with one pass of headers_in */
+typedef struct {
+    ngx_table_elt_t           *origin;
+    ngx_table_elt_t           *method;
+    ngx_table_elt_t           *headers[MAX_REQUEST_HEADERS];
+    ngx_uint_t                 nheaders;
+
+    /* NGX_HTTP_* of Access-Control-Request-Method */
+    ngx_uint_t                 method_mask;
+} ngx_http_cross_origin_request_t;
+
+/* Shared by the main request and all its subrequests */
+typedef struct {
+    ngx_http_cross_origin_request_t  request;
+    ngx_flag_t                       preflight;
+
+    /* the value of the variable of cors_origin_allowed, evaluated once */
+    ngx_int_t                        origin_variable;
+    ngx_flag_t                       origin_allowed;
 } ngx_http_cross_origin_ctx_t;
 
+/*
+ * The last decisions made on a connection, so that the same Origin and
+ * Access-Control-Request-Headers sent again by a keep-alive or HTTP/2
+ * client are not matched again. They are only valid for the same loc
+ * conf.
+ */
+typedef struct {
+    void                      *origin_conf;
+    ngx_flag_t                 origin_split;
+    ngx_flag_t                 origin_allowed;
+    ngx_uint_t                 origin_generation;
+    size_t                     origin_len;
+    u_char                     origin[MAX_ORIGIN_LEN];
+
+    void                      *headers_conf;
+    uint64_t                   headers_mask;
+    size_t                     headers_len;
+    u_char                     headers[MAX_MEMO_HEADERS_LEN];
+} ngx_http_cross_origin_memo_t;
+
+/*
+ * The preflight decisions shared by all the workers. The policy is the
+ * loc conf which made the decision, the generation of the zone is bumped
+ * on every reload, so the decisions of the old configuration are never
+ * found by the new workers.
+ */
+typedef struct {
+    uintptr_t                  policy;
+    ngx_uint_t                 generation;
+    ngx_uint_t                 origins;
+    ngx_uint_t                 method;
+    uint64_t                   headers;
+} ngx_http_cross_origin_cache_key_t;
+
+typedef struct {
+    ngx_rbtree_node_t          node;
+    ngx_queue_t                queue;
+    time_t                     accessed;
+    ngx_http_cross_origin_cache_key_t  key;
+    ngx_flag_t                 allowed;
+    size_t                     len;
+    u_char                     origin[1];
+} ngx_http_cross_origin_cache_node_t;
+
+typedef struct {
+    ngx_rbtree_t               rbtree;
+    ngx_rbtree_node_t          sentinel;
+    ngx_queue_t                queue;
+    ngx_uint_t                 count;
+    ngx_uint_t                 generation;
+} ngx_http_cross_origin_cache_sh_t;
+
 typedef struct {
-    ngx_array_t  *origin_list;
-    ngx_array_t  *method_list;
-    ngx_array_t  *header_list;
-    ngx_array_t  *expose_header_list;
-    ngx_uint_t    safe_methods;
-    ngx_flag_t    enable;
-    ngx_flag_t    origin_unbounded;
-    ngx_flag_t    method_unbounded;
-    ngx_flag_t    header_unbounded;
-    ngx_flag_t    support_credential;
-    time_t        max_age;
+    ngx_http_cross_origin_cache_sh_t  *sh;
+    ngx_slab_pool_t           *shpool;
+    ngx_uint_t                 generation;
+    ngx_uint_t                 max;
+    time_t                     inactive;
+    ngx_flag_t                 defined;
+} ngx_http_cross_origin_cache_t;
+
+typedef struct ngx_http_cross_origin_loc_conf_s
+    ngx_http_cross_origin_loc_conf_t;
+
+typedef ngx_flag_t (*ngx_http_cross_origin_check_preflight_pt)(
+    ngx_http_request_t *r, ngx_http_cross_origin_loc_conf_t *colcf,
+    ngx_str_t *origin_name, ngx_uint_t method, uint64_t requested);
+typedef ngx_flag_t (*ngx_http_cross_origin_check_actual_pt)(
+    ngx_http_request_t *r, ngx_http_cross_origin_loc_conf_t *colcf,
+    ngx_str_t *origin_name);
+typedef ngx_int_t (*ngx_http_cross_origin_add_origin_pt)(
+    ngx_http_request_t *r, ngx_str_t *origin_name);
+
+struct ngx_http_cross_origin_loc_conf_s {
+    ngx_array_t               *origin_list;
+    ngx_http_cross_origin_origins_t  *origins;
+    ngx_http_cross_origin_index_t    *origin_index;
+    ngx_shm_zone_t            *origin_file;
+    ngx_shm_zone_t            *origin_zone;
+    ngx_int_t                  origin_variable;
+    ngx_array_t               *cidr_list;
+    ngx_http_cross_origin_cidrs_t    *cidrs;
+    ngx_uint_t                 origin_hash_max_size;
+    ngx_uint_t                 origin_hash_bucket_size;
+    ngx_array_t               *method_list;
+    ngx_uint_t                 methods;
+    ngx_array_t               *header_list;
+    ngx_http_cross_origin_headers_t  *headers;
+    ngx_array_t               *expose_header_list;
+    ngx_uint_t                 safe_methods;
+    ngx_flag_t                 enable;
+    ngx_flag_t                 origin_unbounded;
+    ngx_flag_t                 method_unbounded;
+    ngx_flag_t                 header_unbounded;
+    ngx_flag_t                 support_credential;
+    time_t                     max_age;
+
+    /* the response header values built at configuration time */
+    ngx_str_t                  allow_methods;
+    ngx_str_t                  allow_headers;
+    ngx_str_t                  expose_headers;
+    ngx_str_t                  max_age_value;
 
     ngx_str_t                  preflight_response_type;
     ngx_http_complex_value_t   preflight_response;
-} ngx_http_cross_origin_loc_conf_t;
+
+    ngx_flag_t                 reject_preflight;
+    ngx_uint_t                 reject_status;
+    ngx_flag_t                 preflight_early;
+
+    ngx_shm_zone_t            *decision_cache;
+
+    /*
+     * The origins of cors_origin_policy, the hash gives the compiled
+     * policy of the cors_policy block mapped to an origin.
+     */
+    ngx_array_t               *origin_policy_list;
+    ngx_hash_t                *origin_policies;
+
+    /* the variants of the policy chosen at merge time */
+    ngx_http_cross_origin_check_preflight_pt  check_preflight;
+    ngx_http_cross_origin_check_actual_pt     check_actual;
+    ngx_http_cross_origin_add_origin_pt       add_origin;
+
+    /* "*" is sent for any origin, the responses need no Vary: Origin */
+    ngx_flag_t                 origin_any;
+
+    /* the zone changed by the requests of this location, not a policy */
+    ngx_shm_zone_t            *api;
+
+    /* the policy named by cors_use */
+    ngx_http_cross_origin_loc_conf_t  *use;
+
+    /*
+     * The compiled policy used by the handlers, NULL if disabled. The
+     * locations with identical directives share the same one.
+     */
+    ngx_http_cross_origin_loc_conf_t  *policy;
+    uint32_t                   policy_hash;
+};
+
+typedef struct {
+    ngx_str_t                  name;
+    ngx_http_cross_origin_loc_conf_t  *conf;
+} ngx_http_cross_origin_policy_t;
+
+typedef struct {
+    ngx_str_t                  origin;
+    ngx_http_cross_origin_loc_conf_t  *conf;
+} ngx_http_cross_origin_origin_policy_t;
+
+typedef struct {
+    /* ngx_http_cross_origin_policy_t, the cors_policy blocks */
+    ngx_array_t                named;
+
+    /* ngx_http_cross_origin_loc_conf_t *, the keys of the compiled policies */
+    ngx_array_t                policies;
+
+    /* ngx_shm_zone_t *, the zones of cors_origin_file */
+    ngx_array_t                files;
+
+    /* ngx_shm_zone_t *, the zones of cors_origin_zone */
+    ngx_array_t                zones;
+} ngx_http_cross_origin_main_conf_t;
 
 
 static ngx_int_t ngx_http_cross_origin_rewrite_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_cross_origin_server_rewrite_handler(
+        ngx_http_request_t *r);
+static ngx_int_t ngx_http_cross_origin_preflight(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf);
 static ngx_table_elt_t * ngx_http_cross_origin_search_header(
         ngx_list_t *list, ngx_str_t *name);
-static ngx_array_t *ngx_http_cross_origin_search_multi_request_header(
-        ngx_http_request_t *r, ngx_str_t *name);
-static ngx_int_t ngx_http_cross_origin_search_list(ngx_array_t *arr, 
-        ngx_str_t *name, ngx_flag_t case_insensitive);
+static ngx_http_cross_origin_ctx_t *ngx_http_cross_origin_get_ctx(
+        ngx_http_request_t *r);
+static ngx_int_t ngx_http_cross_origin_scan_request_headers(
+        ngx_http_request_t *r, ngx_http_cross_origin_request_t *cor);
+static ngx_int_t ngx_http_cross_origin_join_request_headers(
+        ngx_http_request_t *r, ngx_http_cross_origin_request_t *cor);
+static uint64_t ngx_http_cross_origin_request_headers_mask(
+        ngx_http_cross_origin_headers_t *hs, 
+        ngx_http_cross_origin_request_t *cor);
+static ngx_http_cross_origin_memo_t *ngx_http_cross_origin_get_memo(
+        ngx_http_request_t *r);
+static void ngx_http_cross_origin_memo_cleanup(void *data);
+static ngx_int_t ngx_http_cross_origin_match_origin(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *name,
+        ngx_flag_t split);
+static uint64_t ngx_http_cross_origin_match_headers(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_http_cross_origin_request_t *cor);
+static ngx_flag_t ngx_http_cross_origin_variable_allowed(
+        ngx_http_request_t *r, ngx_http_cross_origin_loc_conf_t *colcf);
+static ngx_http_cross_origin_loc_conf_t *ngx_http_cross_origin_origin_policy(
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *origin_name);
+static ngx_flag_t ngx_http_cross_origin_cidrs_find(
+        ngx_http_cross_origin_cidrs_t *cidrs, ngx_str_t *scheme,
+        ngx_str_t *host, ngx_str_t *port);
+static ngx_int_t ngx_http_cross_origin_search_origin(
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *name);
 static ngx_uint_t ngx_http_cross_origin_get_method(ngx_str_t *method);
 static ngx_int_t ngx_http_cross_origin_add_header(ngx_list_t *list, 
         ngx_str_t *key, ngx_str_t *value);
 static ngx_int_t ngx_http_cross_origin_search_string(ngx_str_t *string_array, 
         ngx_str_t *name, ngx_flag_t case_insensitive);
-static ngx_str_t *ngx_http_cross_origin_concatenate_list_value(
-        ngx_http_request_t *r, ngx_array_t *arr);
-static ngx_array_t *ngx_http_cross_origin_split_string(ngx_str_t *str, 
-        u_char separator, ngx_array_t *arr);
+static ngx_http_cross_origin_headers_t *ngx_http_cross_origin_init_headers(
+        ngx_conf_t *cf, ngx_array_t *list);
+static ngx_int_t ngx_http_cross_origin_add_header_name(ngx_conf_t *cf,
+        ngx_hash_keys_arrays_t *ha, ngx_str_t *name, uint64_t *bit);
+static ngx_int_t ngx_http_cross_origin_concatenate_list_value(
+        ngx_conf_t *cf, ngx_array_t *arr, ngx_str_t *value);
+static u_char *ngx_http_cross_origin_split(u_char *p, u_char *last,
+        u_char separator, ngx_str_t *tokens, ngx_uint_t *n);
+static u_char *ngx_http_cross_origin_find_char(u_char *p, u_char *last,
+        u_char c);
+static void ngx_http_cross_origin_strlow(u_char *dst, u_char *src, size_t n);
+
+static ngx_int_t ngx_http_cross_origin_send_status(ngx_http_request_t *r,
+        ngx_uint_t status);
+static ngx_flag_t ngx_http_cross_origin_check_preflight_open(
+        ngx_http_request_t *r, ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_str_t *origin_name, ngx_uint_t method, uint64_t requested);
+static ngx_flag_t ngx_http_cross_origin_check_preflight_list(
+        ngx_http_request_t *r, ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_str_t *origin_name, ngx_uint_t method, uint64_t requested);
+static ngx_flag_t ngx_http_cross_origin_check_actual_open(
+        ngx_http_request_t *r, ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_str_t *origin_name);
+static ngx_flag_t ngx_http_cross_origin_check_actual_list(
+        ngx_http_request_t *r, ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_str_t *origin_name);
+static ngx_int_t ngx_http_cross_origin_add_origin(ngx_http_request_t *r,
+        ngx_str_t *origin_name);
+static ngx_int_t ngx_http_cross_origin_add_origin_credential(
+        ngx_http_request_t *r, ngx_str_t *origin_name);
+static ngx_int_t ngx_http_cross_origin_add_origin_any(ngx_http_request_t *r,
+        ngx_str_t *origin_name);
+static ngx_int_t ngx_http_cross_origin_add_vary(ngx_http_request_t *r,
+        ngx_str_t *value);
+static ngx_int_t ngx_http_cross_origin_cache_lookup(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *origin_name,
+        ngx_uint_t method, uint64_t requested,
+        ngx_http_cross_origin_cache_key_t *key, ngx_flag_t *allowed);
+static void ngx_http_cross_origin_cache_store(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_http_cross_origin_cache_key_t *key, ngx_str_t *origin_name,
+        ngx_flag_t allowed);
+static uint32_t ngx_http_cross_origin_cache_hash(
+        ngx_http_cross_origin_cache_key_t *key, ngx_str_t *origin_name);
+static ngx_http_cross_origin_cache_node_t *ngx_http_cross_origin_cache_find(
+        ngx_http_cross_origin_cache_t *cache, uint32_t hash,
+        ngx_http_cross_origin_cache_key_t *key, ngx_str_t *origin_name);
+static void ngx_http_cross_origin_cache_expire(
+        ngx_http_cross_origin_cache_t *cache, ngx_uint_t n);
+static void ngx_http_cross_origin_cache_rbtree_insert_value(
+        ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+        ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_cross_origin_cache_cmp(
+        ngx_http_cross_origin_cache_node_t *cn,
+        ngx_http_cross_origin_cache_key_t *key, ngx_str_t *origin_name);
+static ngx_int_t ngx_http_cross_origin_init_cache_zone(
+        ngx_shm_zone_t *shm_zone, void *data);
 
 static ngx_int_t ngx_http_cross_origin_filter(ngx_http_request_t *r);
+#if (NGX_DEBUG)
+static size_t ngx_http_cross_origin_pool_used(ngx_pool_t *pool);
+#endif
+
+static ngx_flag_t ngx_http_cross_origin_index_find(
+    ngx_http_cross_origin_index_t *index, u_char *name, size_t len);
+static uint32_t ngx_http_cross_origin_index_hash(u_char *name, size_t len);
+static void ngx_http_cross_origin_index_cleanup(void *data);
+static ngx_uint_t ngx_http_cross_origin_origins_generation(
+    ngx_http_cross_origin_loc_conf_t *colcf);
+static ngx_int_t ngx_http_cross_origin_init_file_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_cross_origin_file_update(
+    ngx_http_cross_origin_file_t *file, ngx_log_t *log);
+static ngx_http_cross_origin_set_t *ngx_http_cross_origin_file_build(
+    ngx_http_cross_origin_file_t *file, u_char *p, u_char *last,
+    ngx_log_t *log);
+static ngx_flag_t ngx_http_cross_origin_sets_find(
+    ngx_http_cross_origin_sets_t *sets, u_char *name, size_t len);
+static size_t ngx_http_cross_origin_set_size(ngx_uint_t n, size_t size,
+    uint32_t *nslots);
+static void ngx_http_cross_origin_set_init(ngx_http_cross_origin_set_t *set,
+    uint32_t nslots, size_t total);
+static ngx_http_cross_origin_set_t *ngx_http_cross_origin_set_create(
+    ngx_slab_pool_t *shpool, ngx_uint_t n, size_t size);
+static ngx_http_cross_origin_set_t *ngx_http_cross_origin_set_copy(
+    ngx_slab_pool_t *shpool, ngx_http_cross_origin_set_t *set);
+static ngx_int_t ngx_http_cross_origin_set_add(
+    ngx_http_cross_origin_set_t *set, u_char *name, size_t len);
+static void ngx_http_cross_origin_sets_publish(
+    ngx_http_cross_origin_sets_t *sets, ngx_http_cross_origin_set_t *set);
+static void ngx_http_cross_origin_sets_reclaim(ngx_slab_pool_t *shpool,
+    ngx_http_cross_origin_sets_t *sets);
+static ngx_int_t ngx_http_cross_origin_init_origin_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_cross_origin_zone_update(
+    ngx_http_cross_origin_zone_t *zone, u_char *name, size_t len,
+    ngx_flag_t add);
+static ngx_int_t ngx_http_cross_origin_api_handler(ngx_http_request_t *r);
+static ngx_flag_t ngx_http_cross_origin_api_local(ngx_connection_t *c);
+static ngx_int_t ngx_http_cross_origin_api_list(ngx_http_request_t *r,
+    ngx_http_cross_origin_zone_t *zone);
+static void ngx_http_cross_origin_file_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_cross_origin_parse_origin(u_char *dst, u_char *src,
+    size_t len, ngx_str_t *scheme, ngx_str_t *host, ngx_str_t *port,
+    ngx_flag_t wildcard);
+static ngx_uint_t ngx_http_cross_origin_default_port(ngx_str_t *scheme);
+static ngx_http_cross_origin_origins_t *ngx_http_cross_origin_init_origins(
+    ngx_conf_t *cf, ngx_array_t *list, ngx_uint_t max_size,
+    ngx_uint_t bucket_size);
+static ngx_hash_t *ngx_http_cross_origin_init_origin_policies(ngx_conf_t *cf,
+    ngx_http_cross_origin_loc_conf_t *conf);
+static ngx_http_cross_origin_cidrs_t *ngx_http_cross_origin_init_cidrs(
+    ngx_conf_t *cf, ngx_array_t *list);
+static ngx_int_t ngx_http_cross_origin_add_cidr(ngx_conf_t *cf,
+    ngx_http_cross_origin_cidrs_t *cidrs, ngx_http_cross_origin_cidr_t *cidr);
+static ngx_uint_t ngx_http_cross_origin_cidr_bits(
+    ngx_http_cross_origin_cidr_t *cidr);
+static int ngx_libc_cdecl ngx_http_cross_origin_cmp_cidrs(const void *one,
+    const void *two);
+static ngx_int_t ngx_http_cross_origin_add_wildcard(ngx_conf_t *cf,
+    ngx_hash_keys_arrays_t *ha, ngx_array_t *hosts, ngx_str_t *origin);
+static int ngx_libc_cdecl ngx_http_cross_origin_cmp_dns_wildcards(
+    const void *one, const void *two);
+#if (NGX_PCRE)
+static ngx_int_t ngx_http_cross_origin_compile_regex(ngx_conf_t *cf,
+    ngx_http_cross_origin_origins_t *origins, ngx_array_t *patterns,
+    ngx_int_t options, ngx_regex_t **regex);
+static ngx_flag_t ngx_http_cross_origin_regex_refers(ngx_str_t *pattern);
+static ngx_regex_t *ngx_http_cross_origin_compile_pattern(ngx_conf_t *cf,
+    ngx_str_t *pattern, ngx_int_t options);
+#endif
 
+static void *ngx_http_cross_origin_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_cross_origin_create_conf(ngx_conf_t *cf);
 static char *ngx_http_cross_origin_merge_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_flag_t ngx_http_cross_origin_conf_is_set(
+    ngx_http_cross_origin_loc_conf_t *conf);
+static ngx_int_t ngx_http_cross_origin_intern_policy(ngx_conf_t *cf,
+    ngx_http_cross_origin_loc_conf_t *conf);
+static ngx_int_t ngx_http_cross_origin_compile_policy(ngx_conf_t *cf,
+    ngx_http_cross_origin_loc_conf_t *conf);
+static void ngx_http_cross_origin_choose_variants(
+        ngx_http_cross_origin_loc_conf_t *conf);
+static uint32_t ngx_http_cross_origin_policy_hash(
+    ngx_http_cross_origin_loc_conf_t *conf);
+static void ngx_http_cross_origin_hash_list(uint32_t *hash,
+    ngx_array_t *list);
+static ngx_flag_t ngx_http_cross_origin_policy_equal(
+    ngx_http_cross_origin_loc_conf_t *one,
+    ngx_http_cross_origin_loc_conf_t *two);
+static ngx_flag_t ngx_http_cross_origin_cidr_list_equal(ngx_array_t *one,
+        ngx_array_t *two);
+static ngx_flag_t ngx_http_cross_origin_origin_policy_list_equal(
+        ngx_array_t *one, ngx_array_t *two);
+static ngx_flag_t ngx_http_cross_origin_list_equal(ngx_array_t *one,
+    ngx_array_t *two);
 static ngx_int_t ngx_http_cross_origin_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_cross_origin_init_process(ngx_cycle_t *cycle);
 
+static char *ngx_http_cors_policy_block(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_cors_policy(ngx_conf_t *cf, ngx_command_t *dummy,
+    void *conf);
+static char *ngx_http_cors_use(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_http_cors_origin_list(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_cors_origin_index(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_cors_origin_file(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_cors_origin_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_cors_origin_allowed(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_cors_origin_cidr(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_cors_origin_policy(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_cors_api(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_shm_zone_t *ngx_http_cross_origin_add_origin_zone(ngx_conf_t *cf,
+    ngx_str_t *name, size_t size);
 static char *ngx_http_cors_method_list(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_cors_header_list(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -85,6 +611,10 @@ static char *ngx_http_cors_safe_methods(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_cors_expose_header_list(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_cors_reject_preflight(ngx_conf_t *cf, ngx_command_t *cmd,
+        void *conf);
+static char *ngx_http_cors_decision_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+        void *conf);
 static char *ngx_http_cors_preflight_response(ngx_conf_t *cf, 
         ngx_command_t *cmd, void *conf);
 
@@ -105,6 +635,69 @@ static ngx_command_t  ngx_http_cross_origin_commands[] = {
       0,
       NULL},
 
+    { ngx_string("cors_origin_index"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cors_origin_index,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_origin_file"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_cors_origin_file,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_origin_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cors_origin_zone,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_origin_cidr"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE23,
+      ngx_http_cors_origin_cidr,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_origin_policy"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE2,
+      ngx_http_cors_origin_policy,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_origin_allowed"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cors_origin_allowed,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_api"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cors_api,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_origin_hash_max_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cross_origin_loc_conf_t, origin_hash_max_size),
+      NULL},
+
+    { ngx_string("cors_origin_hash_bucket_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cross_origin_loc_conf_t, origin_hash_bucket_size),
+      NULL},
+
     { ngx_string("cors_method_list"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
       ngx_http_cors_method_list,
@@ -161,6 +754,41 @@ static ngx_command_t  ngx_http_cross_origin_commands[] = {
       offsetof(ngx_http_cross_origin_loc_conf_t, preflight_response_type),
       NULL},
 
+    { ngx_string("cors_reject_preflight"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      ngx_http_cors_reject_preflight,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_preflight_early"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_cross_origin_loc_conf_t, preflight_early),
+      NULL},
+
+    { ngx_string("cors_policy"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_TAKE1,
+      ngx_http_cors_policy_block,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_use"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_cors_use,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
+    { ngx_string("cors_decision_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_cors_decision_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL},
+
       ngx_null_command
 };
 
@@ -169,7 +797,7 @@ static ngx_http_module_t  ngx_http_cross_origin_module_ctx = {
     NULL,                                       /* preconfiguration */
     ngx_http_cross_origin_init,                 /* postconfiguration */
 
-    NULL,                                       /* create main configuration */
+    ngx_http_cross_origin_create_main_conf,     /* create main configuration */
     NULL,                                       /* init main configuration */
 
     NULL,                                       /* create server configuration */
@@ -187,7 +815,7 @@ ngx_module_t  ngx_http_cross_origin_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_cross_origin_init_process,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -198,9 +826,14 @@ ngx_module_t  ngx_http_cross_origin_module = {
 
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 
-static ngx_str_t request_origin_header = ngx_string("Origin");
-static ngx_str_t request_method_header = ngx_string("Access-Control-Request-Method");
-static ngx_str_t request_headers_header = ngx_string("Access-Control-Request-Headers");
+/* lowercase, compared with the lowcase_key of the request headers */
+static ngx_str_t request_origin_header = ngx_string("origin");
+static ngx_str_t request_method_header = ngx_string("access-control-request-method");
+static ngx_str_t request_headers_header = ngx_string("access-control-request-headers");
+
+static ngx_uint_t request_origin_hash;
+static ngx_uint_t request_method_hash;
+static ngx_uint_t request_headers_hash;
 
 static ngx_str_t response_origin_header = ngx_string("Access-Control-Allow-Origin");
 static ngx_str_t response_credential_header = ngx_string("Access-Control-Allow-Credentials");
@@ -210,18 +843,35 @@ static ngx_str_t response_headers_header = ngx_string("Access-Control-Allow-Head
 static ngx_str_t response_expose_headers_header = ngx_string("Access-Control-Expose-Headers");
 
 static ngx_str_t response_credential_true = ngx_string("true");
+static ngx_str_t response_origin_any = ngx_string("*");
+static ngx_str_t response_vary_header = ngx_string("Vary");
+
+static ngx_str_t vary_actual = ngx_string("Origin");
+static ngx_str_t vary_preflight = ngx_string("Origin, "
+    "Access-Control-Request-Method, Access-Control-Request-Headers");
+static ngx_str_t vary_preflight_any = ngx_string(
+    "Access-Control-Request-Method, Access-Control-Request-Headers");
 
 #define DEFAULT_RESPONSE_CONTENT_TYPE "text/plain"
 
+static ngx_str_t api_content_type = ngx_string(DEFAULT_RESPONSE_CONTENT_TYPE);
 
-/* case-sensitive */
-static ngx_str_t simple_methods[] = {
-    ngx_string("GET"),
-    ngx_string("HEAD"),
-    ngx_string("POST"),
-    { 0, NULL }
+
+/* the ports left out of the canonical origins */
+typedef struct {
+    ngx_str_t                  scheme;
+    ngx_uint_t                 port;
+} ngx_http_cross_origin_default_port_t;
+
+static ngx_http_cross_origin_default_port_t  default_ports[] = {
+    { ngx_string("http://"), 80 },
+    { ngx_string("https://"), 443 },
+    { ngx_string("ws://"), 80 },
+    { ngx_string("wss://"), 443 },
+    { ngx_null_string, 0 }
 };
 
+
 /* case-insensitive */
 static ngx_str_t simple_headers[] = {
     ngx_string("Accept"),
@@ -253,399 +903,394 @@ static ngx_str_t simple_response_headers[] = {
 };
 
 
-static ngx_http_corss_origin_method_name_t  ngx_methods_names[] = {
-   { (u_char *) "GET",       (uint32_t) NGX_HTTP_GET },
-   { (u_char *) "HEAD",      (uint32_t) NGX_HTTP_HEAD },
-   { (u_char *) "POST",      (uint32_t) NGX_HTTP_POST },
-   { (u_char *) "PUT",       (uint32_t) NGX_HTTP_PUT },
-   { (u_char *) "DELETE",    (uint32_t) NGX_HTTP_DELETE },
-   { (u_char *) "MKCOL",     (uint32_t) NGX_HTTP_MKCOL },
-   { (u_char *) "COPY",      (uint32_t) NGX_HTTP_COPY },
-   { (u_char *) "MOVE",      (uint32_t) NGX_HTTP_MOVE },
-   { (u_char *) "OPTIONS",   (uint32_t) NGX_HTTP_OPTIONS },
-   { (u_char *) "PROPFIND" , (uint32_t) NGX_HTTP_PROPFIND },
-   { (u_char *) "PROPPATCH", (uint32_t) NGX_HTTP_PROPPATCH },
-   { (u_char *) "LOCK",      (uint32_t) NGX_HTTP_LOCK },
-   { (u_char *) "UNLOCK",    (uint32_t) NGX_HTTP_UNLOCK },
-   { (u_char *) "PATCH",     (uint32_t) NGX_HTTP_PATCH },
-   { (u_char *) "TRACE",     (uint32_t) NGX_HTTP_TRACE },
-   { NULL, 0 }
-};
-
-
 /* For Preflight Request */
 static ngx_int_t
 ngx_http_cross_origin_rewrite_handler(ngx_http_request_t *r)
 {
-    u_char                           *last;
-    ngx_str_t                        *origin_name, str_max_age;
-    ngx_str_t                        *method_name;
-    ngx_str_t                        *fnames, *str_tmp;
-    ngx_uint_t                        method, match, not_simple, i;
-    ngx_array_t                      *headers;     /* array of ngx_table_elt_t */
-    ngx_array_t                      *field_names; /* array of ngx_str_t */
-    ngx_table_elt_t                  *h;
+    ngx_http_cross_origin_loc_conf_t *colcf;
+
+    colcf = ngx_http_get_module_loc_conf(r, ngx_http_cross_origin_module);
+
+    colcf = colcf->policy;
+    if (colcf == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http cross origin rewrite handler \"%V\"", &r->uri);
+
+    return ngx_http_cross_origin_preflight(r, colcf);
+}
+
+
+/*
+ * For Preflight Request, with the server level configuration before the
+ * location is found.
+ */
+static ngx_int_t
+ngx_http_cross_origin_server_rewrite_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                         rc;
     ngx_http_cross_origin_ctx_t      *ctx;
     ngx_http_cross_origin_loc_conf_t *colcf;
-    
+
     colcf = ngx_http_get_module_loc_conf(r, ngx_http_cross_origin_module);
 
-    if (!colcf->enable) {
-        goto leave;
+    colcf = colcf->policy;
+    if (colcf == NULL || !colcf->preflight_early) {
+        return NGX_DECLINED;
     }
 
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http cross origin server rewrite handler \"%V\"",
+                   &r->uri);
+
+    rc = ngx_http_cross_origin_preflight(r, colcf);
+
+    if (rc == NGX_DECLINED) {
+
+        /* The location checks it again with its own configuration */
+        ctx = ngx_http_get_module_ctx(r->main, ngx_http_cross_origin_module);
+        if (ctx) {
+            ctx->preflight = 0;
+        }
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_cross_origin_preflight(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf)
+{
+    ngx_str_t                        *origin_name;
+    ngx_str_t                        *method_name;
+    uint64_t                          requested;
+    ngx_uint_t                        method, i;
+    ngx_flag_t                        allowed;
+    ngx_http_cross_origin_ctx_t      *ctx;
+    ngx_http_cross_origin_request_t  *cor;
+    ngx_http_cross_origin_cache_key_t key;
+
     if (!(r->method & (NGX_HTTP_OPTIONS))) {
         goto leave;
     }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "http cross origin rewrite handler \"%V\"", &r->uri);
+    ctx = ngx_http_cross_origin_get_ctx(r);
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    cor = &ctx->request;
 
     /* Step 1 */
-    h = ngx_http_cross_origin_search_header(&r->headers_in.headers, 
-            &request_origin_header);
-    if (h == NULL) {
+    if (cor->origin == NULL) {
         goto leave;
     }
-    origin_name = &h->value;
+    origin_name = &cor->origin->value;
+
+    colcf = ngx_http_cross_origin_origin_policy(colcf, origin_name);
 
     /* An OPTIONS request with Origin header is treadted
      * to be preflight request */
-    ctx = ngx_http_get_module_ctx(r, ngx_http_cross_origin_module);
-    if (ctx == NULL) {
-        ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_cross_origin_ctx_t));
-        if (ctx == NULL){
-            return NGX_ERROR;
-        }
-
-        ngx_http_set_ctx(r, ctx, ngx_http_cross_origin_module);
-    }
-
     if (ctx->preflight) {
         goto leave;
     }
     ctx->preflight = 1;
 
-    /* Step 2 */
-    if (!colcf->origin_unbounded) {
-        if (!ngx_http_cross_origin_search_list(colcf->origin_list, origin_name, 0)) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http cross origin header not include in the list of origin");
-            goto leave;
-        }
-    }
-
     /* Step 3 */
     /* Is this necesssary? */
-    h = ngx_http_cross_origin_search_header(&r->headers_in.headers, 
-            &request_method_header);
-    if (h == NULL) {
+    if (cor->method == NULL) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                 "http cross origin not include the request method header");
         goto leave;
     }
 
-    method = ngx_http_cross_origin_get_method(&h->value);
+    method = cor->method_mask;
     if (method == NGX_HTTP_UNKNOWN) {
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                 "http cross origin get unknown method");
-        goto leave;
+        goto reject;
     }
-    method_name = &h->value;
+    method_name = &cor->method->value;
     
     /* Step 4 */
-    field_names = NULL;
-    headers = ngx_http_cross_origin_search_multi_request_header(r,
-            &request_headers_header);
-    if (headers != NULL) {
-        field_names = ngx_array_create(r->pool, 4, sizeof(ngx_str_t));
-        if (field_names == NULL) {
-            return NGX_ERROR;
+    requested = ngx_http_cross_origin_match_headers(r, colcf, cor);
+
+    /* Steps 2, 5 and 6, their outcome can be kept in the decision cache */
+    if (colcf->decision_cache == NULL
+        || ngx_http_cross_origin_cache_lookup(r, colcf, origin_name, method,
+                                              requested, &key, &allowed)
+           != NGX_OK)
+    {
+        allowed = colcf->check_preflight(r, colcf, origin_name, method,
+                                         requested);
+
+        if (colcf->decision_cache) {
+            ngx_http_cross_origin_cache_store(r, colcf, &key, origin_name,
+                                              allowed);
         }
+    }
 
-        h = headers->elts;
-        for (i = 0; i < headers->nelts; i++) {
-            if (ngx_http_cross_origin_split_string(&h[i].value, COMMA, 
-                        field_names) == NULL) {
+    if (!allowed) {
+        goto reject;
+    }
+
+    /* Step 7 */
+    if (colcf->add_origin(r, origin_name) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_cross_origin_add_vary(r, colcf->origin_any
+                                          ? &vary_preflight_any
+                                          : &vary_preflight)
+        == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
+    /* Step 8 */
+    if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
+                &response_max_age_header, &colcf->max_age_value) == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    /* Step 9 */
+    if (!(method & (NGX_HTTP_GET|NGX_HTTP_HEAD|NGX_HTTP_POST))) {
+        if (colcf->method_unbounded) {
+            if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
+                        &response_method_header, method_name) == NGX_ERROR) {
                 return NGX_ERROR;
             }
         }
-    }
-
-    /* Step 5 */
-    if (!colcf->method_unbounded) {
-        if (!ngx_http_cross_origin_search_list(colcf->method_list, method_name, 0)) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http cross origin method not include in the list of method");
-            goto leave;
+        else {
+            /* XXX: Multi-filed-name in one or more headers? */
+            if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
+                        &response_method_header, &colcf->allow_methods)
+                    == NGX_ERROR) {
+                return NGX_ERROR;
+            }
         }
     }
 
-    /* Step 6 */
-    if (!colcf->header_unbounded) {
-        match = 0;
-        if (field_names && field_names->nelts > 0) {
-            fnames = field_names->elts;
-
-            for (i = 0; i < field_names->nelts; i++) {
-                if (ngx_http_cross_origin_search_list(colcf->header_list, 
-                            &fnames[i], 1)) {
-                    match++;
+    /* Step 10 */
+    if (requested & ~colcf->headers->simple) {
+        if (colcf->header_unbounded) {
+            for (i = 0; i < cor->nheaders; i++) {
+                if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
+                            &response_headers_header, &cor->headers[i]->value)
+                        == NGX_ERROR) {
+                    return NGX_ERROR;
                 }
             }
         }
-
-        if (match == 0) {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                    "http cross origin request header not include in the list of headers");
-            goto leave;
+        else {
+            if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
+                        &response_headers_header, &colcf->allow_headers)
+                    == NGX_ERROR) {
+                return NGX_ERROR;
+            }
         }
     }
 
-    /* Step 7 */
-    if (colcf->support_credential) {
-
-        if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_origin_header, origin_name)
-                == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http cross origin prefight request ok, send the response.");
 
-        if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_credential_header, &response_credential_true) 
-                == NGX_ERROR) {
-            return NGX_ERROR;
-        }
-    }
-    else {
-        if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_origin_header, origin_name)
-                == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    /* At last, send this preflight response */
+    if (colcf->preflight_response.value.len == 0) {
+        return ngx_http_cross_origin_send_status(r, NGX_HTTP_NO_CONTENT);
     }
 
-    /* Step 8 */
-    if (colcf->max_age) {
-        str_max_age.data = ngx_pcalloc(r->pool, 64);
-        if (str_max_age.data == NULL) {
-            return NGX_ERROR;
-        }
+    return ngx_http_send_response(r, 200, &colcf->preflight_response_type, 
+            &colcf->preflight_response);
 
-        last = ngx_snprintf(str_max_age.data, 64, "%T", colcf->max_age);
-        str_max_age.len = last - str_max_age.data;
+reject:
 
-        if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_max_age_header, &str_max_age) == NGX_ERROR) {
-            return NGX_ERROR;
-        }
-    }
+    /* A preflight request failing the policy need not reach the upstream */
+    if (colcf->reject_preflight) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http cross origin reject preflight request: %ui",
+                       colcf->reject_status);
 
-    /* Step 9 */
-    if (!ngx_http_cross_origin_search_string(simple_methods, method_name, 0)) {
-        if (colcf->method_unbounded) {
-            if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                        &response_method_header, method_name) == NGX_ERROR) {
-                return NGX_ERROR;
-            }
+        if (ngx_http_cross_origin_add_vary(r, colcf->origin_any
+                                              ? &vary_preflight_any
+                                              : &vary_preflight)
+            == NGX_ERROR)
+        {
+            return NGX_ERROR;
         }
-        else {
-            /* XXX: Multi-filed-name in one or more headers? */
-            str_tmp = ngx_http_cross_origin_concatenate_list_value(r, 
-                    colcf->method_list);
 
-            if (str_tmp && ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                        &response_method_header, str_tmp) == NGX_ERROR) {
-                return NGX_ERROR;
-            }
-        }
+        return ngx_http_cross_origin_send_status(r, colcf->reject_status);
     }
 
-    /* Step 10 */
-    not_simple = 0;
-    if (field_names && field_names->nelts > 0) {
-        fnames = field_names->elts;
-        for (i = 0; i < field_names->nelts; i++) {
-            if (!ngx_http_cross_origin_search_string(simple_headers, &fnames[i], 1)) {
-                not_simple = 1;
-                break;
-            }
-        }
-    }
+leave:
 
-    if (not_simple) {
-        if (colcf->header_unbounded) {
-            if (headers) {
-                h = headers->elts;
-                for (i = 0; i < headers->nelts; i++) {
-                    if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                                &response_headers_header, &h[i].value) == NGX_ERROR) {
-                        return NGX_ERROR;
-                    }
-                }
-            }
-        }
-        else {
-            str_tmp = ngx_http_cross_origin_concatenate_list_value(r, 
-                    colcf->header_list);
+    return NGX_DECLINED;
+}
 
-            if (str_tmp && ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                        &response_headers_header, str_tmp) == NGX_ERROR) {
-                return NGX_ERROR;
-            }
-        }
-    }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "http cross origin prefight request ok, send the response.");
+/* Send a response without body, nothing else is done for the request */
+static ngx_int_t
+ngx_http_cross_origin_send_status(ngx_http_request_t *r, ngx_uint_t status)
+{
+    ngx_int_t                    rc;
 
-    /* At last, send this preflight response */
-    return ngx_http_send_response(r, 200, &colcf->preflight_response_type, 
-            &colcf->preflight_response);
+    rc = ngx_http_discard_request_body(r);
+    if (rc != NGX_OK) {
+        return rc;
+    }
 
-leave:
+    r->headers_out.status = status;
+    r->headers_out.content_length_n = 0;
+    r->header_only = 1;
 
-    return NGX_DECLINED;
+    return ngx_http_send_header(r);
 }
 
 
 /* For Simple Cross-Origin Request, Actual Request, and Redirects */
-static ngx_int_t
-ngx_http_cross_origin_filter(ngx_http_request_t *r)
+/* The policy variants, one of each kind is chosen by the merge */
+
+static ngx_flag_t
+ngx_http_cross_origin_check_preflight_open(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *origin_name,
+        ngx_uint_t method, uint64_t requested)
 {
-    ngx_str_t                         *n, *origin_name, *str_tmp;
-    ngx_uint_t                         match, i;
-    ngx_array_t                       *names;
-    ngx_table_elt_t                   *h;
-    ngx_http_cross_origin_ctx_t       *ctx;
-    ngx_http_cross_origin_loc_conf_t  *colcf;
+    return 1;
+}
 
-    colcf = ngx_http_get_module_loc_conf(r, ngx_http_cross_origin_module);
 
-    if (!colcf->enable) {
-        goto next_filter;
+static ngx_flag_t
+ngx_http_cross_origin_check_preflight_list(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *origin_name,
+        ngx_uint_t method, uint64_t requested)
+{
+    /* Step 2 */
+    if (!colcf->origin_unbounded) {
+        if (!ngx_http_cross_origin_match_origin(r, colcf, origin_name, 0)) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "http cross origin header not include in the list of origin");
+            return 0;
+        }
     }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_cross_origin_module);
-    if (ctx) {
-        if (ctx->preflight) {
-            goto next_filter;
+    /* Step 5 */
+    if (!colcf->method_unbounded) {
+        if (!(colcf->methods & method)) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "http cross origin method not include in the list of method");
+            return 0;
         }
     }
 
-    h = ngx_http_cross_origin_search_header(&r->headers_out.headers, 
-            &response_origin_header);
-    if (h) {
-        /* Already processed by upstream server */
-        goto next_filter;
+    /* Step 6 */
+    /* All the field names must be in the list of headers */
+    if (!colcf->header_unbounded) {
+        if (requested & ~colcf->headers->allowed) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                    "http cross origin request header not include in the list of headers");
+            return 0;
+        }
     }
 
+    return 1;
+}
+
+
+static ngx_flag_t
+ngx_http_cross_origin_check_actual_open(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *origin_name)
+{
+    return 1;
+}
+
+
+static ngx_flag_t
+ngx_http_cross_origin_check_actual_list(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *origin_name)
+{
     /* 5.3 Security: ensure the requests using safe methods */
     if (!colcf->method_unbounded) {
         if ((r->method & colcf->safe_methods) == 0) {
-            goto next_filter;
+            return 0;
         }
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "http cross origin filter");
-
-    /* Step 1 */
-    h = ngx_http_cross_origin_search_header(&r->headers_in.headers,
-            &request_origin_header);
-    if (h == NULL) {
-        goto next_filter;
-    }
-    origin_name = &h->value;
-    
     /* Step 2 */
     if (!colcf->origin_unbounded) {
 
-        match = 0;
-
-        if (ngx_strlchr(origin_name->data, origin_name->data + origin_name->len, SPACE)) {
-
-            names = ngx_array_create(r->pool, 4, sizeof(ngx_str_t));
-            if (names == NULL) {
-                return NGX_ERROR;
-            }
-
-            /* Multiple origin names */
-            names = ngx_http_cross_origin_split_string(origin_name, SPACE, names);
-            if (names && names->nelts > 0) {
-                n = names->elts;
-                for (i = 0; i < names->nelts; i++) {
-                    if (ngx_http_cross_origin_search_list(colcf->origin_list, 
-                                &n[i], 0)) {
-                        match = 1;
-                    }
-                }
-            }
-        }
-        else {
-            /* Single origin name */
-            if (ngx_http_cross_origin_search_list(colcf->origin_list, origin_name, 0)) {
-                match = 1;
-            }
-        }
-
-        if (match == 0) {
+        /* One or more origin names separated by spaces */
+        if (!ngx_http_cross_origin_match_origin(r, colcf, origin_name, 1)) {
             ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                     "http cross origin header not include in the list of origin");
-            goto next_filter;
+            return 0;
         }
     }
 
-    /* Step 3 */
-    if (colcf->support_credential) {
-
-        if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_origin_header, origin_name) == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+    return 1;
+}
 
-        if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_credential_header, 
-                    &response_credential_true) == NGX_ERROR) {
-            return NGX_ERROR;
-        }
-    }
-    else {
-        if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_origin_header, origin_name) == NGX_ERROR) {
-            return NGX_ERROR;
-        }
-    }
 
-    /* Step 4 */
-    if (colcf->expose_header_list && colcf->expose_header_list->nelts) {
+static ngx_int_t
+ngx_http_cross_origin_add_origin(ngx_http_request_t *r, ngx_str_t *origin_name)
+{
+    return ngx_http_cross_origin_add_header(&r->headers_out.headers,
+                                            &response_origin_header,
+                                            origin_name);
+}
 
-        /* XXX: Multi-filed-name in one or more headers? */
-        str_tmp = ngx_http_cross_origin_concatenate_list_value(r, 
-                colcf->expose_header_list);
 
-        if (str_tmp && ngx_http_cross_origin_add_header(&r->headers_out.headers, 
-                    &response_expose_headers_header, str_tmp) == NGX_ERROR) {
-            return NGX_ERROR;
-        }
+static ngx_int_t
+ngx_http_cross_origin_add_origin_credential(ngx_http_request_t *r,
+        ngx_str_t *origin_name)
+{
+    if (ngx_http_cross_origin_add_header(&r->headers_out.headers,
+                &response_origin_header, origin_name) == NGX_ERROR) {
+        return NGX_ERROR;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-            "http cross origin filter all ok");
+    return ngx_http_cross_origin_add_header(&r->headers_out.headers,
+                                            &response_credential_header,
+                                            &response_credential_true);
+}
 
-next_filter:
-    return ngx_http_next_header_filter(r);
+
+static ngx_int_t
+ngx_http_cross_origin_add_origin_any(ngx_http_request_t *r,
+        ngx_str_t *origin_name)
+{
+    return ngx_http_cross_origin_add_header(&r->headers_out.headers,
+                                            &response_origin_header,
+                                            &response_origin_any);
 }
 
 
-static ngx_table_elt_t *
-ngx_http_cross_origin_search_header(ngx_list_t *list, ngx_str_t *name)
+/*
+ * Add the names of the value to Vary. The Vary headers of the response
+ * are scanned once, the names missing from them are appended to the last
+ * one, or the value is added as a new header if there is none. NGX_DONE
+ * if the merged value is allocated from the pool.
+ */
+static ngx_int_t
+ngx_http_cross_origin_add_vary(ngx_http_request_t *r, ngx_str_t *value)
 {
-    ngx_uint_t                   i;
-    ngx_table_elt_t             *h;
+    u_char                      *p, *last, *dst;
+    size_t                       len;
+    ngx_str_t                    names[MAX_VARY_NAMES];
+    ngx_str_t                    tokens[MAX_SPLIT_TOKENS];
+    ngx_uint_t                   i, j, k, n, nnames, found;
+    ngx_table_elt_t             *h, *vary;
     ngx_list_part_t             *part;
 
-    part = &list->part;
+    nnames = MAX_VARY_NAMES;
+    (void) ngx_http_cross_origin_split(value->data, value->data + value->len,
+                                       COMMA, names, &nnames);
+
+    found = 0;
+    vary = NULL;
+
+    part = &r->headers_out.headers.part;
     h = part->elts;
 
     for (i = 0; /* void */; i++) {
@@ -660,523 +1305,5094 @@ ngx_http_cross_origin_search_header(ngx_list_t *list, ngx_str_t *name)
             i = 0;
         }
 
-        if (h[i].key.len == name->len
-                && ngx_strncasecmp(h[i].key.data, name->data, name->len) == 0)
+        if (h[i].hash == 0
+            || h[i].key.len != response_vary_header.len
+            || ngx_strncasecmp(h[i].key.data, response_vary_header.data,
+                               response_vary_header.len) != 0)
         {
-            return &h[i];
+            continue;
         }
-    }
-
-    return NULL;
-}
-
-
-static ngx_array_t *
-ngx_http_cross_origin_search_multi_request_header(ngx_http_request_t *r, 
-        ngx_str_t *name)
-{
-    ngx_uint_t                   i;
-    ngx_array_t                 *arr;
-    ngx_table_elt_t             *h, *te;
-    ngx_list_part_t             *part;
-
-    arr = NULL;
-    part = &r->headers_in.headers.part;
-    h = part->elts;
 
-    for (i = 0; /* void */; i++) {
+        vary = &h[i];
 
-        if (i >= part->nelts) {
-            if (part->next == NULL) {
-                break;
-            }
+        p = h[i].value.data;
+        last = p + h[i].value.len;
 
-            part = part->next;
-            h = part->elts;
-            i = 0;
-        }
+        while (p < last) {
 
-        if (h[i].key.len == name->len
-                && ngx_strncasecmp(h[i].key.data, name->data, name->len) == 0)
-        {
+            n = MAX_SPLIT_TOKENS;
+            p = ngx_http_cross_origin_split(p, last, COMMA, tokens, &n);
 
-            if (arr == NULL) {
+            for (j = 0; j < n; j++) {
 
-                arr = ngx_array_create(r->pool, 1, sizeof(ngx_table_elt_t));
-                if (arr == NULL) {
-                    return NULL;
+                if (tokens[j].len == 1 && tokens[j].data[0] == '*') {
+                    return NGX_OK;
                 }
-            }
 
-            te = ngx_array_push(arr);
-            if (te == NULL) {
-                return NULL;
+                for (k = 0; k < nnames; k++) {
+                    if (tokens[j].len == names[k].len
+                        && ngx_strncasecmp(tokens[j].data, names[k].data,
+                                           names[k].len) == 0)
+                    {
+                        found |= 1 << k;
+                    }
+                }
             }
-
-            *te = h[i];
         }
     }
 
-    return arr;
-}
+    if (vary == NULL) {
+        return ngx_http_cross_origin_add_header(&r->headers_out.headers,
+                                                &response_vary_header, value);
+    }
 
+    if (found == (1u << nnames) - 1) {
+        return NGX_OK;
+    }
 
-static ngx_int_t 
-ngx_http_cross_origin_search_list(ngx_array_t *arr, ngx_str_t *name, 
-        ngx_flag_t case_insensitive)
-{
-    ngx_uint_t                   i, hash;
-    ngx_http_cross_origin_val_t *elt;
+    len = vary->value.len;
 
-    if (arr == NULL || name == NULL || name->len == 0) {
-        return 0;
+    for (k = 0; k < nnames; k++) {
+        if (!(found & (1 << k))) {
+            len += sizeof(", ") - 1 + names[k].len;
+        }
     }
 
-    if (case_insensitive) {
-        hash = ngx_hash_key_lc(name->data, name->len);
-    }
-    else {
-        hash = ngx_hash_key(name->data, name->len);
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
     }
 
-    elt = arr->elts;
+    dst = ngx_cpymem(p, vary->value.data, vary->value.len);
 
-    for (i = 0; i < arr->nelts; i++) {
+    for (k = 0; k < nnames; k++) {
 
-        if (elt[i].hash != hash) {
+        if (found & (1 << k)) {
             continue;
         }
 
-        if (!case_insensitive && elt[i].value.len == name->len
-                && ngx_strncmp(elt[i].value.data, name->data, name->len) == 0)
-        {
-            return 1;
+        if (dst > p) {
+            *dst++ = COMMA;
+            *dst++ = SPACE;
         }
 
-        if (case_insensitive && elt[i].value.len == name->len
-                && ngx_strncasecmp(elt[i].value.data, name->data, name->len) == 0)
-        {
-            return 1;
-        }
+        dst = ngx_cpymem(dst, names[k].data, names[k].len);
     }
 
-    return 0;
+    vary->value.data = p;
+    vary->value.len = dst - p;
+
+    return NGX_DONE;
 }
 
 
-static ngx_uint_t
-ngx_http_cross_origin_get_method(ngx_str_t *method)
+/*
+ * The key is built before the origin is matched, so a decision made with
+ * the origins of cors_origin_file replaced meanwhile is stored under the
+ * old generation and is never found again.
+ */
+static ngx_int_t
+ngx_http_cross_origin_cache_lookup(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *origin_name,
+        ngx_uint_t method, uint64_t requested,
+        ngx_http_cross_origin_cache_key_t *key, ngx_flag_t *allowed)
 {
-    ngx_uint_t                           i;
-    ngx_http_corss_origin_method_name_t *m;
+    uint32_t                             hash;
+    ngx_http_cross_origin_cache_t       *cache;
+    ngx_http_cross_origin_cache_node_t  *cn;
 
-    m = ngx_methods_names;
-    
-    for (i = 0; /* void */; i++) {
+    cache = colcf->decision_cache->data;
 
-        if (m[i].name == NULL) {
-            break;
-        }
+    ngx_memzero(key, sizeof(ngx_http_cross_origin_cache_key_t));
 
-        if (ngx_strncmp(m[i].name, method->data, method->len) == 0)
-        {
-            return m[i].method;
-        }
-    }
+    key->policy = (uintptr_t) colcf;
+    key->generation = cache->generation;
+    key->origins = ngx_http_cross_origin_origins_generation(colcf);
+    key->method = method;
+    key->headers = requested;
 
-    return NGX_HTTP_UNKNOWN;
-}
+    hash = ngx_http_cross_origin_cache_hash(key, origin_name);
 
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-static ngx_int_t
-ngx_http_cross_origin_add_header(ngx_list_t *list, ngx_str_t *key,
-    ngx_str_t *value)
-{
-    ngx_table_elt_t  *h;
+    cn = ngx_http_cross_origin_cache_find(cache, hash, key, origin_name);
 
-    if (value->len) {
-        h = ngx_list_push(list);
-        if (h == NULL) {
-            return NGX_ERROR;
-        }
+    if (cn == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
 
-        h->hash = 1;
-        h->key = *key;
-        h->value = *value;
+    if (ngx_time() - cn->accessed > cache->inactive) {
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+        cache->sh->count--;
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
     }
 
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    cn->accessed = ngx_time();
+    *allowed = cn->allowed;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http cross origin decision cache hit: %i", *allowed);
+
     return NGX_OK;
 }
 
 
-static ngx_int_t 
-ngx_http_cross_origin_search_string(ngx_str_t *string_array, ngx_str_t *name, 
-        ngx_flag_t case_insensitive)
+/* The key is the one built by the lookup */
+static void
+ngx_http_cross_origin_cache_store(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_http_cross_origin_cache_key_t *key, ngx_str_t *origin_name,
+        ngx_flag_t allowed)
 {
-    ngx_str_t *s;
+    size_t                               size;
+    uint32_t                             hash;
+    ngx_http_cross_origin_cache_t       *cache;
+    ngx_http_cross_origin_cache_node_t  *cn;
 
-    if (string_array == NULL || name == NULL || name->len == 0) {
-        return 0;
+    if (origin_name->len > MAX_ORIGIN_LEN) {
+        return;
     }
 
-    s = string_array;
-    while (s->len) {
+    cache = colcf->decision_cache->data;
 
-        if (!case_insensitive && s->len == name->len
-                && ngx_strncmp(s->data, name->data, name->len) == 0)
-        {
-            return 1;
-        }
+    hash = ngx_http_cross_origin_cache_hash(key, origin_name);
 
-        if (case_insensitive && s->len == name->len
-                && ngx_strncasecmp(s->data, name->data, name->len) == 0)
-        {
-            return 1;
-        }
+    size = offsetof(ngx_http_cross_origin_cache_node_t, origin)
+           + origin_name->len;
 
-        s++;
-    }
+    ngx_shmtx_lock(&cache->shpool->mutex);
 
-    return 0;
-}
+    /* another worker could have stored it meanwhile */
+    cn = ngx_http_cross_origin_cache_find(cache, hash, key, origin_name);
 
+    if (cn) {
+        ngx_queue_remove(&cn->queue);
+        goto done;
+    }
 
-static ngx_str_t *
-ngx_http_cross_origin_concatenate_list_value(ngx_http_request_t *r, 
-        ngx_array_t *arr)
-{
-    size_t                       len;
-    u_char                      *last, *end;
-    ngx_str_t                   *s;
-    ngx_uint_t                   i;
-    ngx_http_cross_origin_val_t *elt;
+    ngx_http_cross_origin_cache_expire(cache, 1);
 
-    if (arr == NULL) {
-        return NULL;
-    }
+    cn = ngx_slab_alloc_locked(cache->shpool, size);
 
-    elt = arr->elts;
+    if (cn == NULL) {
+        ngx_http_cross_origin_cache_expire(cache, 0);
 
-    if (arr->nelts == 1) {
-        return &elt->value;
-    }
+        cn = ngx_slab_alloc_locked(cache->shpool, size);
+        if (cn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
 
-    len = 0;
-    for (i = 0; i < arr->nelts; i++) {
-        if (i == arr->nelts - 1) {
-            len += elt[i].value.len;
-            break;
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http cross origin decision cache is full");
+            return;
         }
-
-        len += elt[i].value.len + 1 + 1; /*GET, */
     }
 
-    s = ngx_palloc(r->pool, sizeof(ngx_str_t));
-    if (s == NULL) {
-        return NULL;
-    }
+    cn->node.key = hash;
+    cn->key = *key;
+    cn->len = origin_name->len;
+    ngx_memcpy(cn->origin, origin_name->data, origin_name->len);
 
-    s->data = ngx_palloc(r->pool, len);
-    if (s->data == NULL) {
-        return NULL;
-    }
+    ngx_rbtree_insert(&cache->sh->rbtree, &cn->node);
+    cache->sh->count++;
 
-    last = s->data;
-    end = s->data + len;
+done:
 
-    for (i = 0; i < arr->nelts; i++) {
+    cn->allowed = allowed;
+    cn->accessed = ngx_time();
 
-        if (i == arr->nelts - 1) {
-            /* last element */
-            last = ngx_snprintf(last, end - last, "%V", &elt[i].value);
-            break;
-        }
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
 
-        last = ngx_snprintf(last, end - last, "%V, ", &elt[i].value);
-    }
 
-    s->len = last - s->data;
+static uint32_t
+ngx_http_cross_origin_cache_hash(ngx_http_cross_origin_cache_key_t *key,
+        ngx_str_t *origin_name)
+{
+    uint32_t                     hash;
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, (u_char *) key,
+                     sizeof(ngx_http_cross_origin_cache_key_t));
+    ngx_crc32_update(&hash, origin_name->data, origin_name->len);
+    ngx_crc32_final(hash);
 
-    return s;
+    return hash;
 }
 
 
-static ngx_array_t *
-ngx_http_cross_origin_split_string(ngx_str_t *str, 
-        u_char separator, ngx_array_t *arr)
+static ngx_http_cross_origin_cache_node_t *
+ngx_http_cross_origin_cache_find(ngx_http_cross_origin_cache_t *cache,
+        uint32_t hash, ngx_http_cross_origin_cache_key_t *key,
+        ngx_str_t *origin_name)
 {
-    u_char                      *pre, *p, *last;
-    ngx_str_t                   *ts;
+    ngx_int_t                            rc;
+    ngx_rbtree_node_t                   *node, *sentinel;
+    ngx_http_cross_origin_cache_node_t  *cn;
 
-    last = str->data + str->len;
-    pre = p = str->data;
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
 
-    while(p < last) {
+    while (node != sentinel) {
 
-        ts = ngx_array_push(arr);
-        if (ts == NULL) {
-            return NULL;
+        if (hash < node->key) {
+            node = node->left;
+            continue;
         }
 
-        p = ngx_strlchr(p, last, separator);
-        if (p == NULL) {
-            ts->data = pre;
-            ts->len = last - pre;
-
-            break;
+        if (hash > node->key) {
+            node = node->right;
+            continue;
         }
 
-        ts->data = pre;
-        ts->len = p - pre;
+        /* hash == node->key */
 
-        p++;
+        cn = (ngx_http_cross_origin_cache_node_t *) node;
 
-        while ((p < last) && (*p == SPACE)) {
-            p++;
+        rc = ngx_http_cross_origin_cache_cmp(cn, key, origin_name);
+
+        if (rc == 0) {
+            return cn;
         }
 
-        pre = p;
+        node = (rc < 0) ? node->left : node->right;
     }
 
-    return arr;
+    return NULL;
 }
 
 
-static ngx_int_t
-ngx_http_cross_origin_init(ngx_conf_t *cf)
+/*
+ * Free the least recently used decisions, n of the inactive ones or one
+ * if there is no room for another decision. Called with the zone locked.
+ */
+static void
+ngx_http_cross_origin_cache_expire(ngx_http_cross_origin_cache_t *cache,
+        ngx_uint_t n)
 {
-    ngx_http_handler_pt             *h;
-    ngx_http_core_main_conf_t       *cmcf;
+    time_t                               now;
+    ngx_queue_t                         *q;
+    ngx_http_cross_origin_cache_node_t  *cn;
 
-    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+    now = ngx_time();
 
-    h = ngx_array_push(&cmcf->phases[NGX_HTTP_REWRITE_PHASE].handlers);
-    if (h == NULL) {
-        return NGX_ERROR;
-    }
+    while (n < 3) {
 
-    *h = ngx_http_cross_origin_rewrite_handler;
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return;
+        }
 
-    ngx_http_next_header_filter = ngx_http_top_header_filter;
-    ngx_http_top_header_filter = ngx_http_cross_origin_filter;
+        q = ngx_queue_last(&cache->sh->queue);
 
-    return NGX_OK;
+        cn = ngx_queue_data(q, ngx_http_cross_origin_cache_node_t, queue);
+
+        if (n++ != 0
+            && now - cn->accessed <= cache->inactive
+            && (cache->max == 0 || cache->sh->count < cache->max))
+        {
+            return;
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+        cache->sh->count--;
+    }
 }
 
 
-static char *
-ngx_http_cors_origin_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void
+ngx_http_cross_origin_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+        ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
 {
-    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+    ngx_rbtree_node_t                  **p;
+    ngx_http_cross_origin_cache_node_t  *cn, *cnt;
+    ngx_str_t                            origin;
 
-    ngx_str_t                         *value;
-    ngx_uint_t                         i;
-    ngx_http_cross_origin_val_t       *cov;
+    for ( ;; ) {
 
-    value = cf->args->elts;
+        if (node->key < temp->key) {
 
-    if (colcf->origin_list == NULL) {
-        colcf->origin_list = ngx_array_create(cf->pool, 4,
-                                        sizeof(ngx_http_cross_origin_val_t));
-        if (colcf->origin_list == NULL) {
-            return NGX_CONF_ERROR;
-        }
-    }
+            p = &temp->left;
 
-    for (i = 1; i < cf->args->nelts; i++) {
+        } else if (node->key > temp->key) {
 
-        if (ngx_strcmp(value[i].data, "unbounded") == 0) {
-            colcf->origin_unbounded = 1;
-            break;
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_http_cross_origin_cache_node_t *) node;
+            cnt = (ngx_http_cross_origin_cache_node_t *) temp;
+
+            origin.len = cn->len;
+            origin.data = cn->origin;
+
+            p = (ngx_http_cross_origin_cache_cmp(cnt, &cn->key, &origin) < 0)
+                ? &temp->left : &temp->right;
         }
 
-        cov = ngx_array_push(colcf->origin_list);
-        if (cov == NULL) {
-            return NGX_CONF_ERROR;
+        if (*p == sentinel) {
+            break;
         }
 
-        cov->hash = ngx_hash_key(value[i].data, value[i].len);
-        cov->value = value[i];
+        temp = *p;
     }
 
-    return NGX_CONF_OK;
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
 }
 
 
-static char *
-ngx_http_cors_method_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+/* Compare the key of a lookup with the key of a cached decision */
+static ngx_int_t
+ngx_http_cross_origin_cache_cmp(ngx_http_cross_origin_cache_node_t *cn,
+        ngx_http_cross_origin_cache_key_t *key, ngx_str_t *origin_name)
 {
-    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
-
-    ngx_str_t                         *value;
-    ngx_uint_t                         i, method;
-    ngx_http_cross_origin_val_t       *cov;
+    ngx_int_t                    rc;
 
-    value = cf->args->elts;
+    rc = ngx_memcmp(key, &cn->key, sizeof(ngx_http_cross_origin_cache_key_t));
 
-    if (colcf->method_list == NULL) {
-        colcf->method_list = ngx_array_create(cf->pool, 4,
-                                        sizeof(ngx_http_cross_origin_val_t));
-        if (colcf->method_list == NULL) {
-            return NGX_CONF_ERROR;
-        }
+    if (rc != 0) {
+        return rc;
     }
 
-    for (i = 1; i < cf->args->nelts; i++) {
+    return ngx_memn2cmp(origin_name->data, cn->origin, origin_name->len,
+                        cn->len);
+}
 
-        if (ngx_strcmp(value[i].data, "unbounded") == 0) {
-            colcf->method_unbounded = 1;
-            break;
-        }
 
-        cov = ngx_array_push(colcf->method_list);
-        if (cov == NULL) {
-            return NGX_CONF_ERROR;
-        }
+static ngx_int_t
+ngx_http_cross_origin_filter(ngx_http_request_t *r)
+{
+    ngx_int_t                          rc;
+    ngx_str_t                         *origin_name, *vary;
+    ngx_table_elt_t                   *h;
+    ngx_http_cross_origin_ctx_t       *ctx;
+    ngx_http_cross_origin_request_t   *cor;
+    ngx_http_cross_origin_loc_conf_t  *colcf;
+#if (NGX_DEBUG)
+    size_t                             used;
+    ngx_list_part_t                   *part;
 
-        method = ngx_http_cross_origin_get_method(&value[i]);
-        if (method == NGX_HTTP_UNKNOWN) {
-            return NGX_CONF_ERROR;
-        }
+    used = ngx_http_cross_origin_pool_used(r->pool);
+    part = r->headers_out.headers.last;
+#endif
 
-        colcf->safe_methods |= method;
+    colcf = ngx_http_get_module_loc_conf(r, ngx_http_cross_origin_module);
 
-        cov->hash = ngx_hash_key(value[i].data, value[i].len);
-        cov->value = value[i];
+    colcf = colcf->policy;
+    if (colcf == NULL) {
+        goto next_filter;
     }
 
-    return NGX_CONF_OK;
-}
+    vary = colcf->origin_any ? NULL : &vary_actual;
+
+    /*
+     * The request headers are scanned once for the main request, the
+     * other responses and the subrequests reuse its context.
+     */
+    ctx = ngx_http_cross_origin_get_ctx(r);
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
 
+#if (NGX_DEBUG)
+    /* the context is the only allocation, once for the main request */
+    used = ngx_http_cross_origin_pool_used(r->pool);
+#endif
 
-static char *
-ngx_http_cors_header_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
-{
-    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+    if (ctx->preflight) {
 
-    ngx_str_t                         *value;
-    ngx_uint_t                         i;
-    ngx_http_cross_origin_val_t       *cov;
+        /*
+         * The preflight responses of this module have the names already,
+         * a failed preflight passed on to the upstream needs them as well.
+         */
+        vary = colcf->origin_any ? &vary_preflight_any : &vary_preflight;
+        goto vary;
+    }
 
-    value = cf->args->elts;
+    cor = &ctx->request;
 
-    if (colcf->header_list == NULL) {
-        colcf->header_list = ngx_array_create(cf->pool, 4,
-                                        sizeof(ngx_http_cross_origin_val_t));
-        if (colcf->header_list == NULL) {
-            return NGX_CONF_ERROR;
-        }
+    h = ngx_http_cross_origin_search_header(&r->headers_out.headers, 
+            &response_origin_header);
+    if (h) {
+        /* Already processed by upstream server */
+        goto next_filter;
     }
 
-    for (i = 1; i < cf->args->nelts; i++) {
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http cross origin filter");
 
-        if (ngx_strcmp(value[i].data, "unbounded") == 0) {
-            colcf->header_unbounded = 1;
-            break;
+    /*
+     * Step 1, "*" is sent without the Origin header too, so the response
+     * is the same for all the requests.
+     */
+    if (cor->origin == NULL) {
+        if (!colcf->origin_any) {
+            goto vary;
         }
 
-        cov = ngx_array_push(colcf->header_list);
-        if (cov == NULL) {
-            return NGX_CONF_ERROR;
-        }
+        origin_name = NULL;
 
-        cov->hash = ngx_hash_key_lc(value[i].data, value[i].len);
-        cov->value = value[i];
+    } else {
+        origin_name = &cor->origin->value;
+
+        colcf = ngx_http_cross_origin_origin_policy(colcf, origin_name);
     }
 
-    return NGX_CONF_OK;
-}
+    /* 5.3 Security and Step 2 */
+    if (!colcf->check_actual(r, colcf, origin_name)) {
+        goto vary;
+    }
 
+    /* Step 3 */
+    if (colcf->add_origin(r, origin_name) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-static char *
-ngx_http_cors_safe_methods(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
-{
-    ngx_http_cross_origin_loc_conf_t   *colcf = conf;
+    /* Step 4 */
+    /* XXX: Multi-filed-name in one or more headers? */
+    if (ngx_http_cross_origin_add_header(&r->headers_out.headers, 
+                &response_expose_headers_header, &colcf->expose_headers)
+            == NGX_ERROR) {
+        return NGX_ERROR;
+    }
 
-    ngx_str_t                          *value;
-    ngx_uint_t                          i, method;
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+            "http cross origin filter all ok");
 
-    value = cf->args->elts;
+vary:
 
-    for (i = 1; i < cf->args->nelts; i++) {
+    /* a cache must not serve the response to the other origins */
+    if (vary) {
+        rc = ngx_http_cross_origin_add_vary(r, vary);
 
-        method = ngx_http_cross_origin_get_method(&value[i]);
-        if (method == NGX_HTTP_UNKNOWN) {
-            return NGX_CONF_ERROR;
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
         }
 
-        colcf->safe_methods |= method;
+#if (NGX_DEBUG)
+        if (rc == NGX_DONE) {
+            /* the merged Vary value is the only allocation of its own */
+            used = ngx_http_cross_origin_pool_used(r->pool);
+        }
+#endif
     }
 
-    return NGX_CONF_OK;
+next_filter:
+
+#if (NGX_DEBUG)
+    /*
+     * Nothing but the slots of headers_out should come from the pool,
+     * the variable of cors_origin_allowed is the only exception.
+     */
+    if (r->headers_out.headers.last == part
+        && (colcf == NULL || colcf->origin_variable == NGX_CONF_UNSET)
+        && ngx_http_cross_origin_pool_used(r->pool) != used)
+    {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                      "http cross origin filter allocated %uz bytes "
+                      "from the request pool",
+                      ngx_http_cross_origin_pool_used(r->pool) - used);
+    }
+#endif
+
+    return ngx_http_next_header_filter(r);
 }
 
 
-static char *
-ngx_http_cors_expose_header_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
-{
-    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+#if (NGX_DEBUG)
 
-    ngx_str_t                         *value;
-    ngx_uint_t                         i;
-    ngx_http_cross_origin_val_t       *cov;
+static size_t
+ngx_http_cross_origin_pool_used(ngx_pool_t *pool)
+{
+    size_t                       used;
+    ngx_pool_t                  *p;
 
-    value = cf->args->elts;
+    used = 0;
 
-    if (colcf->expose_header_list == NULL) {
-        colcf->expose_header_list = ngx_array_create(cf->pool, 4,
-                                        sizeof(ngx_http_cross_origin_val_t));
-        if (colcf->expose_header_list == NULL) {
-            return NGX_CONF_ERROR;
-        }
+    for (p = pool; p; p = p->d.next) {
+        used += p->d.last - (u_char *) p;
     }
 
-    for (i = 1; i < cf->args->nelts; i++) {
+    return used;
+}
 
-        if (ngx_http_cross_origin_search_string(simple_response_headers, 
-                    &value[i], 1)) {
-            continue;
-        }
+#endif
+
+
+static ngx_table_elt_t *
+ngx_http_cross_origin_search_header(ngx_list_t *list, ngx_str_t *name)
+{
+    ngx_uint_t                   i;
+    ngx_table_elt_t             *h;
+    ngx_list_part_t             *part;
+
+    part = &list->part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].key.len == name->len
+                && ngx_strncasecmp(h[i].key.data, name->data, name->len) == 0)
+        {
+            return &h[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * The request headers are collected only once, at the first place which
+ * needs them. The subrequests share the headers_in of the main request,
+ * so they share its context too.
+ */
+static ngx_http_cross_origin_ctx_t *
+ngx_http_cross_origin_get_ctx(ngx_http_request_t *r)
+{
+    ngx_http_cross_origin_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r->main, ngx_http_cross_origin_module);
+    if (ctx) {
+        return ctx;
+    }
+
+    ctx = ngx_palloc(r->pool, sizeof(ngx_http_cross_origin_ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    if (ngx_http_cross_origin_scan_request_headers(r->main, &ctx->request)
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    ctx->preflight = 0;
+    ctx->origin_variable = NGX_CONF_UNSET;
+
+    ngx_http_set_ctx(r->main, ctx, ngx_http_cross_origin_module);
+
+    return ctx;
+}
+
+
+/*
+ * Collect the Origin, Access-Control-Request-Method and
+ * Access-Control-Request-Headers headers with one pass of the request
+ * headers. The header names are compared with the hash and the lowercase
+ * key which are computed when the headers are parsed.
+ */
+static ngx_int_t
+ngx_http_cross_origin_scan_request_headers(ngx_http_request_t *r, 
+        ngx_http_cross_origin_request_t *cor)
+{
+    ngx_uint_t                   i, more;
+    ngx_table_elt_t             *h;
+    ngx_list_part_t             *part;
+
+    ngx_memzero(cor, sizeof(ngx_http_cross_origin_request_t));
+
+    cor->method_mask = NGX_HTTP_UNKNOWN;
+
+    more = 0;
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == request_origin_hash
+                && h[i].key.len == request_origin_header.len
+                && ngx_memcmp(h[i].lowcase_key, request_origin_header.data,
+                              request_origin_header.len) == 0)
+        {
+            if (cor->origin == NULL) {
+                cor->origin = &h[i];
+            }
+
+            continue;
+        }
+
+        if (h[i].hash == request_method_hash
+                && h[i].key.len == request_method_header.len
+                && ngx_memcmp(h[i].lowcase_key, request_method_header.data,
+                              request_method_header.len) == 0)
+        {
+            if (cor->method == NULL) {
+                cor->method = &h[i];
+                cor->method_mask = ngx_http_cross_origin_get_method(
+                                                            &h[i].value);
+            }
+
+            continue;
+        }
+
+        if (h[i].hash == request_headers_hash
+                && h[i].key.len == request_headers_header.len
+                && ngx_memcmp(h[i].lowcase_key, request_headers_header.data,
+                              request_headers_header.len) == 0)
+        {
+            if (cor->nheaders == MAX_REQUEST_HEADERS) {
+                more = 1;
+                continue;
+            }
+
+            cor->headers[cor->nheaders++] = &h[i];
+        }
+    }
+
+    if (more) {
+        return ngx_http_cross_origin_join_request_headers(r, cor);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * The rare request with more Access-Control-Request-Headers lines than
+ * the pointers kept gets them joined to one value with ", ", the way nginx
+ * joins the repeated list headers, so none of the names is lost.
+ */
+static ngx_int_t
+ngx_http_cross_origin_join_request_headers(ngx_http_request_t *r,
+        ngx_http_cross_origin_request_t *cor)
+{
+    u_char            *p;
+    size_t             len;
+    ngx_uint_t         i;
+    ngx_array_t        lines;
+    ngx_table_elt_t   *h, **line, *joined;
+    ngx_list_part_t   *part;
+
+    if (ngx_array_init(&lines, r->pool, MAX_REQUEST_HEADERS * 2,
+                       sizeof(ngx_table_elt_t *))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    len = 0;
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == request_headers_hash
+                && h[i].key.len == request_headers_header.len
+                && ngx_memcmp(h[i].lowcase_key, request_headers_header.data,
+                              request_headers_header.len) == 0)
+        {
+            line = ngx_array_push(&lines);
+            if (line == NULL) {
+                return NGX_ERROR;
+            }
+
+            *line = &h[i];
+            len += sizeof(", ") - 1 + h[i].value.len;
+        }
+    }
+
+    joined = ngx_palloc(r->pool, sizeof(ngx_table_elt_t));
+    if (joined == NULL) {
+        return NGX_ERROR;
+    }
+
+    *joined = *cor->headers[0];
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    joined->value.data = p;
+
+    line = lines.elts;
+
+    for (i = 0; i < lines.nelts; i++) {
+        if (i) {
+            *p++ = COMMA;
+            *p++ = SPACE;
+        }
+
+        p = ngx_cpymem(p, line[i]->value.data, line[i]->value.len);
+    }
+
+    joined->value.len = p - joined->value.data;
+
+    cor->headers[0] = joined;
+    cor->nheaders = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * The memo lives as long as the client connection, it is found by its
+ * cleanup handler. The streams of an HTTP/2 connection share the memo
+ * of the real connection.
+ */
+static ngx_http_cross_origin_memo_t *
+ngx_http_cross_origin_get_memo(ngx_http_request_t *r)
+{
+    ngx_connection_t             *c;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_cross_origin_memo_t *memo;
+
+    c = r->connection;
+
+#if (NGX_HTTP_V2)
+    if (r->stream) {
+        c = r->stream->connection->connection;
+    }
+#endif
+
+    for (cln = c->pool->cleanup; cln; cln = cln->next) {
+        if (cln->handler == ngx_http_cross_origin_memo_cleanup) {
+            return cln->data;
+        }
+    }
+
+    cln = ngx_pool_cleanup_add(c->pool, sizeof(ngx_http_cross_origin_memo_t));
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    memo = cln->data;
+
+    memo->origin_conf = NULL;
+    memo->headers_conf = NULL;
+
+    cln->handler = ngx_http_cross_origin_memo_cleanup;
+
+    return memo;
+}
+
+
+static void
+ngx_http_cross_origin_memo_cleanup(void *data)
+{
+    /* the memo has nothing to release, the handler only tags it */
+}
+
+
+/*
+ * Search the origin name, or each of the names separated by spaces if
+ * split is set. The result is remembered by the connection.
+ */
+static ngx_int_t
+ngx_http_cross_origin_match_origin(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf, ngx_str_t *name,
+        ngx_flag_t split)
+{
+    u_char                       *p, *last;
+    ngx_str_t                     names[MAX_SPLIT_TOKENS];
+    ngx_uint_t                    i, n, generation;
+    ngx_int_t                     match;
+    ngx_http_cross_origin_memo_t *memo;
+
+    if (colcf->origin_variable != NGX_CONF_UNSET) {
+        return ngx_http_cross_origin_variable_allowed(r, colcf);
+    }
+
+    memo = ngx_http_cross_origin_get_memo(r);
+
+    /* read before the match, see ngx_http_cross_origin_cache_lookup() */
+    generation = ngx_http_cross_origin_origins_generation(colcf);
+
+    if (memo
+        && memo->origin_conf == colcf
+        && memo->origin_generation == generation
+        && memo->origin_split == split
+        && memo->origin_len == name->len
+        && ngx_memcmp(memo->origin, name->data, name->len) == 0)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http cross origin memo hit origin: %i",
+                       memo->origin_allowed);
+
+        return memo->origin_allowed;
+    }
+
+    match = 0;
+
+    if (split) {
+        p = name->data;
+        last = p + name->len;
+
+        while (p < last && !match) {
+
+            n = MAX_SPLIT_TOKENS;
+            p = ngx_http_cross_origin_split(p, last, SPACE, names, &n);
+
+            for (i = 0; i < n; i++) {
+                if (ngx_http_cross_origin_search_origin(colcf, &names[i])) {
+                    match = 1;
+                    break;
+                }
+            }
+        }
+
+    } else {
+        match = ngx_http_cross_origin_search_origin(colcf, name);
+    }
+
+    if (memo && name->len <= MAX_ORIGIN_LEN) {
+        memo->origin_conf = colcf;
+        memo->origin_split = split;
+        memo->origin_generation = generation;
+        memo->origin_allowed = match;
+        memo->origin_len = name->len;
+        ngx_memcpy(memo->origin, name->data, name->len);
+    }
+
+    return match;
+}
+
+
+/*
+ * The origin is allowed unless the variable of cors_origin_allowed is
+ * empty or "0". The value is kept in the context of a preflight request,
+ * an actual request evaluates it once in the header filter.
+ */
+static ngx_flag_t
+ngx_http_cross_origin_variable_allowed(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf)
+{
+    ngx_flag_t                    allowed;
+    ngx_http_variable_value_t    *vv;
+    ngx_http_cross_origin_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r->main, ngx_http_cross_origin_module);
+
+    if (ctx && ctx->origin_variable == colcf->origin_variable) {
+        return ctx->origin_allowed;
+    }
+
+    vv = ngx_http_get_indexed_variable(r, colcf->origin_variable);
+
+    allowed = vv != NULL && !vv->not_found && vv->len
+              && !(vv->len == 1 && vv->data[0] == '0');
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http cross origin variable allowed: %i", allowed);
+
+    if (ctx) {
+        ctx->origin_variable = colcf->origin_variable;
+        ctx->origin_allowed = allowed;
+    }
+
+    return allowed;
+}
+
+
+/*
+ * The bits of Access-Control-Request-Headers, the values are remembered
+ * by the connection joined with commas, which yields the same names.
+ */
+static uint64_t
+ngx_http_cross_origin_match_headers(ngx_http_request_t *r,
+        ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_http_cross_origin_request_t *cor)
+{
+    u_char                        buf[MAX_MEMO_HEADERS_LEN], *p;
+    size_t                        len;
+    uint64_t                      mask;
+    ngx_uint_t                    i;
+    ngx_http_cross_origin_memo_t *memo;
+
+    if (cor->nheaders == 0) {
+        return 0;
+    }
+
+    len = cor->nheaders - 1;
+
+    for (i = 0; i < cor->nheaders; i++) {
+        len += cor->headers[i]->value.len;
+    }
+
+    memo = NULL;
+
+    if (len <= MAX_MEMO_HEADERS_LEN) {
+
+        p = buf;
+
+        for (i = 0; i < cor->nheaders; i++) {
+            if (i) {
+                *p++ = COMMA;
+            }
+
+            p = ngx_cpymem(p, cor->headers[i]->value.data,
+                           cor->headers[i]->value.len);
+        }
+
+        memo = ngx_http_cross_origin_get_memo(r);
+
+        if (memo
+            && memo->headers_conf == colcf
+            && memo->headers_len == len
+            && ngx_memcmp(memo->headers, buf, len) == 0)
+        {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http cross origin memo hit request headers");
+
+            return memo->headers_mask;
+        }
+    }
+
+    mask = ngx_http_cross_origin_request_headers_mask(colcf->headers, cor);
+
+    if (memo) {
+        memo->headers_conf = colcf;
+        memo->headers_mask = mask;
+        memo->headers_len = len;
+        ngx_memcpy(memo->headers, buf, len);
+    }
+
+    return mask;
+}
+
+
+/*
+ * Map the field names of Access-Control-Request-Headers to their bits,
+ * UNKNOWN_HEADER_BIT is set for the names which are not configured.
+ */
+static uint64_t
+ngx_http_cross_origin_request_headers_mask(
+        ngx_http_cross_origin_headers_t *hs,
+        ngx_http_cross_origin_request_t *cor)
+{
+    u_char                      *p, *last;
+    u_char                       buf[MAX_HEADER_NAME_LEN];
+    size_t                       len;
+    uint64_t                     mask, *bit;
+    ngx_str_t                    names[MAX_SPLIT_TOKENS];
+    ngx_uint_t                   i, j, n, key;
+
+    mask = 0;
+
+    for (i = 0; i < cor->nheaders; i++) {
+
+        p = cor->headers[i]->value.data;
+        last = p + cor->headers[i]->value.len;
+
+        while (p < last) {
+
+            n = MAX_SPLIT_TOKENS;
+            p = ngx_http_cross_origin_split(p, last, COMMA, names, &n);
+
+            for (j = 0; j < n; j++) {
+
+                len = names[j].len;
+
+                if (len > MAX_HEADER_NAME_LEN) {
+                    mask |= UNKNOWN_HEADER_BIT;
+                    continue;
+                }
+
+                ngx_http_cross_origin_strlow(buf, names[j].data, len);
+                key = ngx_hash_key(buf, len);
+
+                bit = ngx_hash_find(&hs->hash, key, buf, len);
+
+                mask |= bit ? *bit : UNKNOWN_HEADER_BIT;
+            }
+        }
+    }
+
+    return mask;
+}
+
+
+/* 
+ * The origins are canonicalized when the hash is built, so the lookup is
+ * done with the canonical request origin, a malformed one is not looked
+ * up at all. The exact origins are searched first, then the wildcard ones
+ * by the host name. The regular expressions are only tried if both of
+ * them miss.
+ */
+static ngx_int_t 
+ngx_http_cross_origin_search_origin(ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_str_t *name)
+{
+    u_char                            buf[MAX_ORIGIN_LEN];
+    ngx_int_t                         len;
+    ngx_str_t                         scheme, host, port;
+    ngx_uint_t                        i, key;
+    ngx_array_t                      *origins;
+    ngx_hash_combined_t              *hash;
+    ngx_http_cross_origin_file_t     *file;
+    ngx_http_cross_origin_zone_t     *zone;
+    ngx_http_cross_origin_wildcard_t *wc;
+#if (NGX_PCRE)
+    ngx_regex_t                     **regex;
+#endif
+
+    if ((colcf->origins == NULL && colcf->origin_index == NULL
+         && colcf->origin_file == NULL && colcf->origin_zone == NULL
+         && colcf->cidrs == NULL)
+            || name == NULL || name->len == 0 || name->len > MAX_ORIGIN_LEN)
+    {
+        return 0;
+    }
+
+    len = ngx_http_cross_origin_parse_origin(buf, name->data, name->len,
+                                             &scheme, &host, &port, 0);
+    if (len == NGX_ERROR) {
+        return 0;
+    }
+
+    key = ngx_hash_key(buf, len);
+
+    if (colcf->origin_index
+            && ngx_http_cross_origin_index_find(colcf->origin_index, buf, len))
+    {
+        return 1;
+    }
+
+    if (colcf->origin_file) {
+        file = colcf->origin_file->data;
+
+        if (ngx_http_cross_origin_sets_find(&file->sh->sets, buf, len)) {
+            return 1;
+        }
+    }
+
+    if (colcf->origin_zone) {
+        zone = colcf->origin_zone->data;
+
+        if (ngx_http_cross_origin_sets_find(zone->sh, buf, len)) {
+            return 1;
+        }
+    }
+
+    hash = colcf->origins ? &colcf->origins->hash : NULL;
+
+    if (hash && hash->hash.buckets
+            && ngx_hash_find(&hash->hash, key, buf, len))
+    {
+        return 1;
+    }
+
+    /* the opaque origin "null" has no host */
+    if (host.len) {
+        origins = (hash && hash->wc_head)
+                  ? ngx_hash_find_wc_head(hash->wc_head, host.data, host.len)
+                  : NULL;
+
+        if (origins) {
+            wc = origins->elts;
+
+            for (i = 0; i < origins->nelts; i++) {
+
+                if (wc[i].scheme.len == scheme.len
+                        && wc[i].port.len == port.len
+                        && ngx_strncmp(wc[i].scheme.data, scheme.data,
+                                       scheme.len) == 0
+                        && ngx_strncmp(wc[i].port.data, port.data,
+                                       port.len) == 0)
+                {
+                    return 1;
+                }
+            }
+        }
+
+        if (colcf->cidrs
+                && ngx_http_cross_origin_cidrs_find(colcf->cidrs, &scheme,
+                                                    &host, &port))
+        {
+            return 1;
+        }
+    }
+
+    if (colcf->origins == NULL) {
+        return 0;
+    }
+
+#if (NGX_PCRE)
+
+    if (colcf->origins->regex
+            && ngx_regex_exec(colcf->origins->regex, name, NULL, 0) >= 0)
+    {
+        return 1;
+    }
+
+    if (colcf->origins->regex_caseless
+            && ngx_regex_exec(colcf->origins->regex_caseless, name, NULL, 0)
+               >= 0)
+    {
+        return 1;
+    }
+
+    if (colcf->origins->regexes) {
+        regex = colcf->origins->regexes->elts;
+
+        for (i = 0; i < colcf->origins->regexes->nelts; i++) {
+            if (ngx_regex_exec(regex[i], name, NULL, 0) >= 0) {
+                return 1;
+            }
+        }
+    }
+
+#endif
+
+    return 0;
+}
+
+
+/* The name is lowercased already */
+static ngx_flag_t
+ngx_http_cross_origin_index_find(ngx_http_cross_origin_index_t *index,
+        u_char *name, size_t len)
+{
+    uint32_t                             hash, i, n;
+    ngx_http_cross_origin_index_slot_t  *slot;
+
+    hash = ngx_http_cross_origin_index_hash(name, len);
+
+    for (i = hash & index->mask, n = 0; n <= index->mask;
+         i = (i + 1) & index->mask, n++)
+    {
+        slot = &index->slots[i];
+
+        if (slot->len == 0) {
+            return 0;
+        }
+
+        if (slot->hash == hash
+            && slot->len == len
+            && len <= index->arena_size
+            && slot->offset <= index->arena_size - len
+            && ngx_memcmp(index->arena + slot->offset, name, len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * The policy of the cors_policy block mapped to the origin by
+ * cors_origin_policy, or the one of the location.
+ */
+static ngx_http_cross_origin_loc_conf_t *
+ngx_http_cross_origin_origin_policy(ngx_http_cross_origin_loc_conf_t *colcf,
+        ngx_str_t *origin_name)
+{
+    u_char                             buf[MAX_ORIGIN_LEN];
+    ngx_int_t                          len;
+    ngx_str_t                          scheme, host, port;
+    ngx_http_cross_origin_loc_conf_t  *policy;
+
+    if (colcf->origin_policies == NULL
+        || origin_name->len == 0 || origin_name->len > MAX_ORIGIN_LEN)
+    {
+        return colcf;
+    }
+
+    len = ngx_http_cross_origin_parse_origin(buf, origin_name->data,
+                                             origin_name->len, &scheme,
+                                             &host, &port, 0);
+    if (len == NGX_ERROR) {
+        return colcf;
+    }
+
+    policy = ngx_hash_find(colcf->origin_policies, ngx_hash_key(buf, len),
+                           buf, len);
+
+    return policy ? policy : colcf;
+}
+
+
+/*
+ * Match an origin with an IP literal host, like "http://10.1.2.3:8080" or
+ * "https://[fd00::1]", with the networks of cors_origin_cidr.
+ */
+static ngx_flag_t
+ngx_http_cross_origin_cidrs_find(ngx_http_cross_origin_cidrs_t *cidrs,
+        ngx_str_t *scheme, ngx_str_t *host, ngx_str_t *port)
+{
+    in_addr_t                       addr;
+    uintptr_t                       value;
+    ngx_int_t                       n;
+    ngx_uint_t                      i;
+    ngx_array_t                    *entries;
+    ngx_http_cross_origin_cidr_t  **cidr;
+#if (NGX_HAVE_INET6)
+    struct in6_addr                 addr6;
+#endif
+
+    /* the port of a canonical origin is valid, or the default one */
+    if (port->len) {
+        n = ngx_atoi(port->data + 1, port->len - 1);
+
+    } else {
+        n = ngx_http_cross_origin_default_port(scheme);
+    }
+
+    if (host->len > 2 && host->data[0] == '[') {
+
+#if (NGX_HAVE_INET6)
+        if (host->data[host->len - 1] != ']'
+            || ngx_inet6_addr(host->data + 1, host->len - 2, addr6.s6_addr)
+               != NGX_OK)
+        {
+            return 0;
+        }
+
+        value = ngx_radix128tree_find(cidrs->tree6, addr6.s6_addr);
+#else
+        return 0;
+#endif
+
+    } else {
+        addr = ngx_inet_addr(host->data, host->len);
+
+        if (addr == INADDR_NONE) {
+            return 0;
+        }
+
+        value = ngx_radix32tree_find(cidrs->tree, ntohl(addr));
+    }
+
+    if (value == NGX_RADIX_NO_VALUE) {
+        return 0;
+    }
+
+    entries = (ngx_array_t *) value;
+    cidr = entries->elts;
+
+    for (i = 0; i < entries->nelts; i++) {
+
+        if (cidr[i]->scheme.len == scheme->len
+            && ngx_strncmp(cidr[i]->scheme.data, scheme->data, scheme->len)
+               == 0
+            && (ngx_uint_t) n >= cidr[i]->port_min
+            && (ngx_uint_t) n <= cidr[i]->port_max)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * The generation is noted before the current set is read, so the set
+ * found is never older than the one current under the noted generation.
+ */
+static ngx_flag_t
+ngx_http_cross_origin_sets_find(ngx_http_cross_origin_sets_t *sets,
+        u_char *name, size_t len)
+{
+    ngx_flag_t                    found;
+    ngx_atomic_t                 *reader;
+    ngx_http_cross_origin_set_t  *set;
+
+    reader = &sets->readers[ngx_process_slot];
+
+    *reader = sets->generation + 1;
+
+    ngx_memory_barrier();
+
+    set = (ngx_http_cross_origin_set_t *) sets->current;
+
+    found = set && ngx_http_cross_origin_index_find(&set->index, name, len);
+
+    ngx_memory_barrier();
+
+    *reader = 0;
+
+    return found;
+}
+
+
+/*
+ * The generation of the origins replaced without a reload, 0 if none.
+ * The generations never go back, so their sum changes with either.
+ */
+static ngx_uint_t
+ngx_http_cross_origin_origins_generation(
+        ngx_http_cross_origin_loc_conf_t *colcf)
+{
+    ngx_uint_t                     generation;
+    ngx_http_cross_origin_file_t  *file;
+    ngx_http_cross_origin_zone_t  *zone;
+
+    generation = 0;
+
+    if (colcf->origin_file) {
+        file = colcf->origin_file->data;
+        generation += file->sh->sets.generation;
+    }
+
+    if (colcf->origin_zone) {
+        zone = colcf->origin_zone->data;
+        generation += zone->sh->generation;
+    }
+
+    return generation;
+}
+
+
+/* FNV-1a, the same as the one of util/cors-origin-index.pl */
+static uint32_t
+ngx_http_cross_origin_index_hash(u_char *name, size_t len)
+{
+    uint32_t                     hash;
+
+    hash = 2166136261u;
+
+    while (len--) {
+        hash ^= *name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/*
+ * Parse an origin like "HTTPS://Www.Foo.com:08443" in one pass into its
+ * canonical form "https://www.foo.com:8443" in dst: the scheme and the
+ * host are lowercased and the default port of the scheme is left out.
+ * The scheme "https://", the host "www.foo.com" and the port ":8443" point
+ * into dst. The canonical origin is never longer, so dst may be src.
+ *
+ * Returns the length of the canonical origin, or NGX_ERROR if the origin
+ * is malformed. A wildcard host "*.foo.com" is only valid in the
+ * configuration. The opaque origin "null" has no scheme, host and port.
+ */
+static ngx_int_t
+ngx_http_cross_origin_parse_origin(u_char *dst, u_char *src, size_t len,
+    ngx_str_t *scheme, ngx_str_t *host, ngx_str_t *port, ngx_flag_t wildcard)
+{
+    u_char      c, *p, *d, *last, *start;
+    ngx_uint_t  n, dp;
+
+    p = src;
+    d = dst;
+    last = src + len;
+
+    if (len == 4 && ngx_strncasecmp(src, (u_char *) "null", 4) == 0) {
+        ngx_memcpy(dst, "null", 4);
+
+        scheme->len = 0;
+        scheme->data = dst;
+        *host = *scheme;
+        *port = *scheme;
+
+        return 4;
+    }
+
+    /* scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." ) */
+
+    while (p < last) {
+        c = (u_char) (*p | 0x20);
+
+        if (c >= 'a' && c <= 'z') {
+            *d++ = c;
+            p++;
+            continue;
+        }
+
+        if (d > dst
+            && ((*p >= '0' && *p <= '9') || *p == '+' || *p == '-'
+                || *p == '.'))
+        {
+            *d++ = *p++;
+            continue;
+        }
+
+        break;
+    }
+
+    if (d == dst
+        || last - p < 3 || p[0] != ':' || p[1] != '/' || p[2] != '/')
+    {
+        return NGX_ERROR;
+    }
+
+    d = ngx_cpymem(d, "://", 3);
+    p += 3;
+
+    scheme->data = dst;
+    scheme->len = d - dst;
+
+    host->data = d;
+
+    if (wildcard && last - p > 2 && p[0] == '*' && p[1] == '.') {
+        *d++ = '*';
+        *d++ = '.';
+        p += 2;
+    }
+
+    start = d;
+
+    if (p < last && *p == '[') {
+
+        /* an IPv6 literal, its syntax is checked by the lookups of it */
+        *d++ = *p++;
+
+        while (p < last && *p != ']') {
+            c = (u_char) (*p | 0x20);
+
+            if (!((*p >= '0' && *p <= '9') || (c >= 'a' && c <= 'f')
+                  || *p == ':' || *p == '.'))
+            {
+                return NGX_ERROR;
+            }
+
+            *d++ = c;
+            p++;
+        }
+
+        if (p == last || d - start == 1) {
+            return NGX_ERROR;
+        }
+
+        *d++ = *p++;
+
+    } else {
+
+        while (p < last && *p != ':') {
+            c = (u_char) (*p | 0x20);
+
+            if (!((c >= 'a' && c <= 'z') || (*p >= '0' && *p <= '9')
+                  || *p == '-' || *p == '.' || *p == '_'))
+            {
+                return NGX_ERROR;
+            }
+
+            *d++ = (*p >= 'A' && *p <= 'Z') ? c : *p;
+            p++;
+        }
+    }
+
+    if (d == start) {
+        return NGX_ERROR;
+    }
+
+    host->len = d - host->data;
+
+    port->data = d;
+
+    if (p < last) {
+
+        /* the host ends with ':' here, then the port follows */
+        if (*p++ != ':' || p == last) {
+            return NGX_ERROR;
+        }
+
+        for (n = 0; p < last; p++) {
+            if (*p < '0' || *p > '9') {
+                return NGX_ERROR;
+            }
+
+            n = n * 10 + (*p - '0');
+
+            if (n > 65535) {
+                return NGX_ERROR;
+            }
+        }
+
+        dp = ngx_http_cross_origin_default_port(scheme);
+
+        /* all of the port is read, so d can not overrun src */
+        if (dp == 0 || n != dp) {
+            d = ngx_sprintf(d, ":%ui", n);
+        }
+    }
+
+    port->len = d - port->data;
+
+    return d - dst;
+}
+
+
+/* 0 for the schemes without a default port */
+static ngx_uint_t
+ngx_http_cross_origin_default_port(ngx_str_t *scheme)
+{
+    ngx_http_cross_origin_default_port_t  *dp;
+
+    for (dp = default_ports; dp->scheme.len; dp++) {
+        if (dp->scheme.len == scheme->len
+            && ngx_strncmp(dp->scheme.data, scheme->data, scheme->len) == 0)
+        {
+            return dp->port;
+        }
+    }
+
+    return 0;
+}
+
+
+/* The whole method token is compared, the method names are case-sensitive */
+static ngx_uint_t
+ngx_http_cross_origin_get_method(ngx_str_t *method)
+{
+    u_char  *m;
+
+    m = method->data;
+
+    switch (method->len) {
+
+    case 3:
+        if (ngx_strncmp(m, "GET", 3) == 0) {
+            return NGX_HTTP_GET;
+        }
+
+        if (ngx_strncmp(m, "PUT", 3) == 0) {
+            return NGX_HTTP_PUT;
+        }
+
+        break;
+
+    case 4:
+        if (ngx_strncmp(m, "POST", 4) == 0) {
+            return NGX_HTTP_POST;
+        }
+
+        if (ngx_strncmp(m, "HEAD", 4) == 0) {
+            return NGX_HTTP_HEAD;
+        }
+
+        if (ngx_strncmp(m, "COPY", 4) == 0) {
+            return NGX_HTTP_COPY;
+        }
+
+        if (ngx_strncmp(m, "MOVE", 4) == 0) {
+            return NGX_HTTP_MOVE;
+        }
+
+        if (ngx_strncmp(m, "LOCK", 4) == 0) {
+            return NGX_HTTP_LOCK;
+        }
+
+        break;
+
+    case 5:
+        if (ngx_strncmp(m, "PATCH", 5) == 0) {
+            return NGX_HTTP_PATCH;
+        }
+
+        if (ngx_strncmp(m, "MKCOL", 5) == 0) {
+            return NGX_HTTP_MKCOL;
+        }
+
+        if (ngx_strncmp(m, "TRACE", 5) == 0) {
+            return NGX_HTTP_TRACE;
+        }
+
+        break;
+
+    case 6:
+        if (ngx_strncmp(m, "DELETE", 6) == 0) {
+            return NGX_HTTP_DELETE;
+        }
+
+        if (ngx_strncmp(m, "UNLOCK", 6) == 0) {
+            return NGX_HTTP_UNLOCK;
+        }
+
+        break;
+
+    case 7:
+        if (ngx_strncmp(m, "OPTIONS", 7) == 0) {
+            return NGX_HTTP_OPTIONS;
+        }
+
+        break;
+
+    case 8:
+        if (ngx_strncmp(m, "PROPFIND", 8) == 0) {
+            return NGX_HTTP_PROPFIND;
+        }
+
+        break;
+
+    case 9:
+        if (ngx_strncmp(m, "PROPPATCH", 9) == 0) {
+            return NGX_HTTP_PROPPATCH;
+        }
+
+        break;
+    }
+
+    return NGX_HTTP_UNKNOWN;
+}
+
+
+static ngx_int_t
+ngx_http_cross_origin_add_header(ngx_list_t *list, ngx_str_t *key,
+    ngx_str_t *value)
+{
+    ngx_table_elt_t  *h;
+
+    if (value->len) {
+        h = ngx_list_push(list);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = 1;
+        h->key = *key;
+        h->value = *value;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t 
+ngx_http_cross_origin_search_string(ngx_str_t *string_array, ngx_str_t *name, 
+        ngx_flag_t case_insensitive)
+{
+    ngx_str_t *s;
+
+    if (string_array == NULL || name == NULL || name->len == 0) {
+        return 0;
+    }
+
+    s = string_array;
+    while (s->len) {
+
+        if (!case_insensitive && s->len == name->len
+                && ngx_strncmp(s->data, name->data, name->len) == 0)
+        {
+            return 1;
+        }
+
+        if (case_insensitive && s->len == name->len
+                && ngx_strncasecmp(s->data, name->data, name->len) == 0)
+        {
+            return 1;
+        }
+
+        s++;
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_cross_origin_concatenate_list_value(ngx_conf_t *cf, 
+        ngx_array_t *arr, ngx_str_t *value)
+{
+    size_t                       len;
+    u_char                      *last, *end;
+    ngx_uint_t                   i;
+    ngx_http_cross_origin_val_t *elt;
+
+    if (arr == NULL || arr->nelts == 0) {
+        ngx_str_null(value);
+        return NGX_OK;
+    }
+
+    elt = arr->elts;
+
+    if (arr->nelts == 1) {
+        *value = elt->value;
+        return NGX_OK;
+    }
+
+    len = 0;
+    for (i = 0; i < arr->nelts; i++) {
+        if (i == arr->nelts - 1) {
+            len += elt[i].value.len;
+            break;
+        }
+
+        len += elt[i].value.len + 1 + 1; /*GET, */
+    }
+
+    value->data = ngx_pnalloc(cf->pool, len);
+    if (value->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    last = value->data;
+    end = value->data + len;
+
+    for (i = 0; i < arr->nelts; i++) {
+
+        if (i == arr->nelts - 1) {
+            /* last element */
+            last = ngx_snprintf(last, end - last, "%V", &elt[i].value);
+            break;
+        }
+
+        last = ngx_snprintf(last, end - last, "%V, ", &elt[i].value);
+    }
+
+    value->len = last - value->data;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Split [p, last) by the separator into at most *n tokens, the spaces and
+ * tabs around each token are trimmed and the empty ones skipped. The
+ * tokens point into the original string, *n is set to the number of
+ * them. The returned pointer is where to continue if the buffer is full.
+ */
+static u_char *
+ngx_http_cross_origin_split(u_char *p, u_char *last, u_char separator,
+        ngx_str_t *tokens, ngx_uint_t *n)
+{
+    u_char                      *start, *end;
+    ngx_uint_t                   i;
+
+    i = 0;
+
+    while (p < last && i < *n) {
+
+        start = p;
+        end = ngx_http_cross_origin_find_char(p, last, separator);
+
+        p = (end < last) ? end + 1 : last;
+
+        while (start < end && (*start == SPACE || *start == '\t')) {
+            start++;
+        }
+
+        while (end > start && (*(end - 1) == SPACE || *(end - 1) == '\t')) {
+            end--;
+        }
+
+        if (start == end) {
+            continue;
+        }
+
+        tokens[i].data = start;
+        tokens[i].len = end - start;
+        i++;
+    }
+
+    *n = i;
+
+    return p;
+}
+
+
+/* Return the first c in [p, last), or last if there is none */
+static u_char *
+ngx_http_cross_origin_find_char(u_char *p, u_char *last, u_char c)
+{
+#if (NGX_HTTP_CROSS_ORIGIN_SSE2)
+    int                          bits;
+    __m128i                      v, sep;
+
+    sep = _mm_set1_epi8((char) c);
+
+    while (last - p >= 16) {
+
+        v = _mm_loadu_si128((const __m128i *) p);
+        bits = _mm_movemask_epi8(_mm_cmpeq_epi8(v, sep));
+
+        if (bits) {
+            return p + __builtin_ctz(bits);
+        }
+
+        p += 16;
+    }
+#endif
+
+    while (p < last && *p != c) {
+        p++;
+    }
+
+    return p;
+}
+
+
+static void
+ngx_http_cross_origin_strlow(u_char *dst, u_char *src, size_t n)
+{
+#if (NGX_HTTP_CROSS_ORIGIN_SSE2)
+    __m128i                      v, upper, lower_a, upper_z, case_bit;
+
+    lower_a = _mm_set1_epi8('A' - 1);
+    upper_z = _mm_set1_epi8('Z' + 1);
+    case_bit = _mm_set1_epi8(0x20);
+
+    /* the bytes above 0x7f are negative, so never taken as 'A' - 'Z' */
+    while (n >= 16) {
+
+        v = _mm_loadu_si128((const __m128i *) src);
+
+        upper = _mm_and_si128(_mm_cmpgt_epi8(v, lower_a),
+                              _mm_cmplt_epi8(v, upper_z));
+        v = _mm_or_si128(v, _mm_and_si128(upper, case_bit));
+
+        _mm_storeu_si128((__m128i *) dst, v);
+
+        dst += 16;
+        src += 16;
+        n -= 16;
+    }
+#endif
+
+    while (n) {
+        *dst = ngx_tolower(*src);
+        dst++;
+        src++;
+        n--;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_cross_origin_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt             *h;
+    ngx_http_core_main_conf_t       *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_REWRITE_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_cross_origin_rewrite_handler;
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_SERVER_REWRITE_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_cross_origin_server_rewrite_handler;
+
+    request_origin_hash = ngx_hash_key(request_origin_header.data,
+                                       request_origin_header.len);
+    request_method_hash = ngx_hash_key(request_method_header.data,
+                                       request_method_header.len);
+    request_headers_hash = ngx_hash_key(request_headers_header.data,
+                                        request_headers_header.len);
+
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_cross_origin_filter;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Every worker checks the files of cors_origin_file from a timer, the
+ * time of the next check in the zone lets only one of them do it. A
+ * process that died searching may have left its slot of readers noted.
+ */
+static ngx_int_t
+ngx_http_cross_origin_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                          i;
+    ngx_shm_zone_t                    **zones;
+    ngx_http_cross_origin_file_t       *file;
+    ngx_http_cross_origin_zone_t       *zone;
+    ngx_http_cross_origin_main_conf_t  *comcf;
+
+    /* the cache manager and loader serve no requests */
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    comcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                                ngx_http_cross_origin_module);
+    if (comcf == NULL) {
+        return NGX_OK;
+    }
+
+    zones = comcf->files.elts;
+
+    for (i = 0; i < comcf->files.nelts; i++) {
+        file = zones[i]->data;
+
+        file->sh->sets.readers[ngx_process_slot] = 0;
+
+        file->event.handler = ngx_http_cross_origin_file_handler;
+        file->event.data = file;
+        file->event.log = cycle->log;
+        file->event.cancelable = 1;
+
+        ngx_add_timer(&file->event, file->interval * 1000);
+    }
+
+    zones = comcf->zones.elts;
+
+    for (i = 0; i < comcf->zones.nelts; i++) {
+        zone = zones[i]->data;
+
+        zone->sh->readers[ngx_process_slot] = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t  ngx_http_cors_policy_argument_number[] = {
+    NGX_CONF_NOARGS,
+    NGX_CONF_TAKE1,
+    NGX_CONF_TAKE2,
+    NGX_CONF_TAKE3,
+    NGX_CONF_TAKE4,
+    NGX_CONF_TAKE5,
+    NGX_CONF_TAKE6,
+    NGX_CONF_TAKE7
+};
+
+
+/*
+ * cors_policy name { ... }
+ *
+ * The block takes the other directives of this module only, they are set
+ * into a separate loc conf which is compiled when the block ends.
+ */
+static char *
+ngx_http_cors_policy_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_main_conf_t  *comcf = conf;
+
+    char                               *rv;
+    ngx_str_t                          *value;
+    ngx_uint_t                          i;
+    ngx_conf_t                          save;
+    ngx_http_cross_origin_policy_t     *policy;
+    ngx_http_cross_origin_loc_conf_t   *colcf, *defaults;
+
+    value = cf->args->elts;
+
+    policy = comcf->named.elts;
+
+    for (i = 0; i < comcf->named.nelts; i++) {
+        if (policy[i].name.len == value[1].len
+            && ngx_strncmp(policy[i].name.data, value[1].data,
+                           value[1].len) == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate cors policy \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    colcf = ngx_http_cross_origin_create_conf(cf);
+    if (colcf == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    save = *cf;
+    cf->handler = ngx_http_cors_policy;
+    cf->handler_conf = (void *) colcf;
+
+    rv = ngx_conf_parse(cf, NULL);
+
+    *cf = save;
+
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    defaults = ngx_http_cross_origin_create_conf(cf);
+    if (defaults == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    rv = ngx_http_cross_origin_merge_conf(cf, defaults, colcf);
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    policy = ngx_array_push(&comcf->named);
+    if (policy == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    policy->name = value[1];
+    policy->conf = colcf;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_cors_policy(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
+{
+    char                        *rv;
+    ngx_str_t                   *value;
+    ngx_uint_t                   n;
+    ngx_command_t               *cmd;
+
+    value = cf->args->elts;
+    n = cf->args->nelts;
+
+    for (cmd = ngx_http_cross_origin_commands; cmd->name.len; cmd++) {
+
+        if (cmd->name.len != value[0].len
+            || ngx_strcmp(cmd->name.data, value[0].data) != 0)
+        {
+            continue;
+        }
+
+        if (cmd->set == ngx_http_cors_policy_block
+            || cmd->set == ngx_http_cors_use
+            || cmd->set == ngx_http_cors_origin_policy)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"%V\" directive is not allowed in "
+                               "\"cors_policy\"", &value[0]);
+            return NGX_CONF_ERROR;
+        }
+
+        if (!((cmd->type & NGX_CONF_FLAG) ? n == 2
+              : (cmd->type & NGX_CONF_1MORE) ? n >= 2
+              : (cmd->type & NGX_CONF_2MORE) ? n >= 3
+              : n <= NGX_CONF_MAX_ARGS
+                && (cmd->type & ngx_http_cors_policy_argument_number[n - 1])))
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid number of arguments in \"%V\" "
+                               "directive", &value[0]);
+            return NGX_CONF_ERROR;
+        }
+
+        rv = cmd->set(cf, cmd, conf);
+
+        if (rv == NGX_CONF_OK || rv == NGX_CONF_ERROR) {
+            return rv;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" directive %s", &value[0], rv);
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "unknown directive \"%V\" in \"cors_policy\"",
+                       &value[0]);
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_cors_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t   *colcf = conf;
+
+    ngx_str_t                          *value;
+    ngx_uint_t                          i;
+    ngx_http_cross_origin_policy_t     *policy;
+    ngx_http_cross_origin_main_conf_t  *comcf;
+
+    if (colcf->use != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    comcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cross_origin_module);
+
+    policy = comcf->named.elts;
+
+    for (i = 0; i < comcf->named.nelts; i++) {
+        if (policy[i].name.len == value[1].len
+            && ngx_strncmp(policy[i].name.data, value[1].data,
+                           value[1].len) == 0)
+        {
+            colcf->use = policy[i].conf;
+            return NGX_CONF_OK;
+        }
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "unknown cors policy \"%V\"", &value[1]);
+    return NGX_CONF_ERROR;
+}
+
+
+static char *
+ngx_http_cors_origin_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_int_t                          rc;
+    ngx_str_t                         *value, scheme, host, port;
+    ngx_uint_t                         i;
+    ngx_http_cross_origin_val_t       *cov;
+
+    value = cf->args->elts;
+
+    if (colcf->origin_list == NULL) {
+        colcf->origin_list = ngx_array_create(cf->pool, 4,
+                                        sizeof(ngx_http_cross_origin_val_t));
+        if (colcf->origin_list == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "unbounded") == 0) {
+            colcf->origin_unbounded = 1;
+            break;
+        }
+
+        cov = ngx_array_push(colcf->origin_list);
+        if (cov == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cov->value = value[i];
+
+        /* one hash entry for all the spellings of an origin */
+        if (value[i].data[0] != '~' && value[i].len <= MAX_ORIGIN_LEN) {
+
+            cov->value.data = ngx_pnalloc(cf->pool, value[i].len);
+            if (cov->value.data == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            rc = ngx_http_cross_origin_parse_origin(cov->value.data,
+                                                    value[i].data,
+                                                    value[i].len, &scheme,
+                                                    &host, &port, 1);
+            if (rc == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid origin \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            cov->value.len = rc;
+        }
+
+        cov->hash = ngx_hash_key(cov->value.data, cov->value.len);
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * The index is mapped once at configuration time, the workers share its
+ * pages through the page cache. Only its header and size are checked, so
+ * a reload does not read the whole file.
+ */
+static char *
+ngx_http_cors_origin_index(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    u_char                                *start;
+    size_t                                 size;
+    ngx_fd_t                               fd;
+    ngx_str_t                             *value, path;
+    ngx_file_info_t                        fi;
+    ngx_pool_cleanup_t                    *cln;
+    ngx_http_cross_origin_index_t         *index;
+    ngx_http_cross_origin_index_header_t   header;
+
+    if (colcf->origin_index != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    path = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &path, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    fd = ngx_open_file(path.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%V\" failed", &path);
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%V\" failed", &path);
+        goto failed;
+    }
+
+    size = ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_http_cross_origin_index_header_t)) {
+        goto invalid;
+    }
+
+    start = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (start == MAP_FAILED) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           "mmap(\"%V\") failed", &path);
+        goto failed;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &path);
+    }
+
+    fd = NGX_INVALID_FILE;
+
+    cln = ngx_pool_cleanup_add(cf->pool, sizeof(ngx_http_cross_origin_index_t));
+    if (cln == NULL) {
+        munmap(start, size);
+        return NGX_CONF_ERROR;
+    }
+
+    index = cln->data;
+
+    index->path = path;
+    index->start = start;
+    index->size = size;
+
+    cln->handler = ngx_http_cross_origin_index_cleanup;
+
+    ngx_memcpy(&header, start, sizeof(ngx_http_cross_origin_index_header_t));
+
+    if (ngx_memcmp(header.magic, ORIGIN_INDEX_MAGIC, 8) != 0
+        || header.byte_order != ORIGIN_INDEX_BYTE_ORDER
+        || header.nslots == 0
+        || (header.nslots & (header.nslots - 1)) != 0
+        || header.nentries >= header.nslots
+        || (size - sizeof(ngx_http_cross_origin_index_header_t))
+           / sizeof(ngx_http_cross_origin_index_slot_t) < header.nslots
+        || size - sizeof(ngx_http_cross_origin_index_header_t)
+           - header.nslots * sizeof(ngx_http_cross_origin_index_slot_t)
+           != header.arena_size)
+    {
+        goto invalid;
+    }
+
+    index->slots = (ngx_http_cross_origin_index_slot_t *)
+                       (start + sizeof(ngx_http_cross_origin_index_header_t));
+    index->mask = header.nslots - 1;
+    index->arena = (u_char *) (index->slots + header.nslots);
+    index->arena_size = header.arena_size;
+
+    colcf->origin_index = index;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid cors origin index \"%V\"", &path);
+
+failed:
+
+    if (fd != NGX_INVALID_FILE && ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &path);
+    }
+
+    return NGX_CONF_ERROR;
+}
+
+
+static void
+ngx_http_cross_origin_index_cleanup(void *data)
+{
+    ngx_http_cross_origin_index_t  *index = data;
+
+    if (munmap(index->start, index->size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "munmap(\"%V\") failed", &index->path);
+    }
+}
+
+
+/*
+ * cors_origin_file path [interval=time] [size=size]
+ *
+ * The origins are loaded into a zone named after the path, which is
+ * shared by all the places using the same file.
+ */
+static char *
+ngx_http_cors_origin_file(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    u_char                             *p;
+    ssize_t                             size;
+    time_t                              interval;
+    ngx_str_t                          *value, path, name, s;
+    ngx_uint_t                          i;
+    ngx_shm_zone_t                     *shm_zone, **zp;
+    ngx_http_cross_origin_file_t       *file;
+    ngx_http_cross_origin_main_conf_t  *comcf;
+
+    if (colcf->origin_file != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    path = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &path, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    size = ORIGIN_FILE_SIZE;
+    interval = ORIGIN_FILE_INTERVAL;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.data = value[i].data + 9;
+            s.len = value[i].len - 9;
+
+            interval = ngx_parse_time(&s, 1);
+
+            if (interval == (time_t) NGX_ERROR || interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid interval value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "size=", 5) == 0) {
+
+            s.data = value[i].data + 5;
+            s.len = value[i].len - 5;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len = sizeof("cors_origin_file:") - 1 + path.len;
+    name.data = ngx_pnalloc(cf->pool, name.len);
+    if (name.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    p = ngx_cpymem(name.data, "cors_origin_file:",
+                   sizeof("cors_origin_file:") - 1);
+    ngx_memcpy(p, path.data, path.len);
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_cross_origin_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    file = shm_zone->data;
+
+    if (file == NULL) {
+        file = ngx_pcalloc(cf->pool, sizeof(ngx_http_cross_origin_file_t));
+        if (file == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        file->path = path;
+        file->interval = interval;
+
+        shm_zone->init = ngx_http_cross_origin_init_file_zone;
+        shm_zone->data = file;
+
+        comcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cross_origin_module);
+
+        zp = ngx_array_push(&comcf->files);
+        if (zp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *zp = shm_zone;
+
+    } else if (file->interval != interval) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the interval of \"%V\" conflicts with the "
+                           "one already declared", &path);
+        return NGX_CONF_ERROR;
+    }
+
+    colcf->origin_file = shm_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+/* cors_origin_zone name[:size] */
+static char *
+ngx_http_cors_origin_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    u_char                        *p;
+    ssize_t                        size;
+    ngx_str_t                     *value, name, s;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_http_cross_origin_zone_t  *zone;
+
+    if (colcf->origin_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    name = value[1];
+    size = 0;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p) {
+        name.len = p - name.data;
+
+        s.data = p + 1;
+        s.len = value[1].data + value[1].len - s.data;
+
+        size = ngx_parse_size(&s);
+
+        if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid zone size \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    shm_zone = ngx_http_cross_origin_add_origin_zone(cf, &name, size);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (size) {
+        zone = shm_zone->data;
+
+        if (zone->defined) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the origin zone \"%V\" is already defined",
+                               &name);
+            return NGX_CONF_ERROR;
+        }
+
+        zone->defined = 1;
+    }
+
+    colcf->origin_zone = shm_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * cors_origin_cidr scheme address[/mask] [port[-port]]
+ *
+ * The origins with an IP literal host in the network, every port if the
+ * ports are not given.
+ */
+static char *
+ngx_http_cors_origin_cidr(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    u_char                        *p, *last;
+    ngx_int_t                      rc, min, max;
+    ngx_str_t                     *value;
+    ngx_uint_t                     i;
+    ngx_http_cross_origin_cidr_t  *cidr;
+
+    value = cf->args->elts;
+
+    if (colcf->cidr_list == NULL) {
+        colcf->cidr_list = ngx_array_create(cf->pool, 4,
+                                    sizeof(ngx_http_cross_origin_cidr_t));
+        if (colcf->cidr_list == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    cidr = ngx_array_push(colcf->cidr_list);
+    if (cidr == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memzero(cidr, sizeof(ngx_http_cross_origin_cidr_t));
+
+    for (i = 0; i < value[1].len; i++) {
+        if (!((value[1].data[i] >= 'a' && value[1].data[i] <= 'z')
+              || (value[1].data[i] >= 'A' && value[1].data[i] <= 'Z')
+              || (value[1].data[i] >= '0' && value[1].data[i] <= '9')
+              || value[1].data[i] == '+' || value[1].data[i] == '-'
+              || value[1].data[i] == '.'))
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid scheme \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    /* "http" is kept as "http://" like the scheme of a parsed origin */
+    cidr->scheme.len = value[1].len + sizeof("://") - 1;
+    cidr->scheme.data = ngx_pnalloc(cf->pool, cidr->scheme.len);
+    if (cidr->scheme.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_strlow(cidr->scheme.data, value[1].data, value[1].len);
+    ngx_memcpy(cidr->scheme.data + value[1].len, "://", sizeof("://") - 1);
+
+    rc = ngx_ptocidr(&value[2], &cidr->cidr);
+
+    if (rc == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid network \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (rc == NGX_DONE) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "low address bits of %V are meaningless",
+                           &value[2]);
+    }
+
+#if !(NGX_HAVE_INET6)
+    if (cidr->cidr.family != AF_INET) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "IPv6 network \"%V\" is not supported "
+                           "on this platform", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+#endif
+
+    if (cf->args->nelts == 3) {
+        cidr->port_min = 0;
+        cidr->port_max = 65535;
+
+        return NGX_CONF_OK;
+    }
+
+    p = value[3].data;
+    last = p + value[3].len;
+
+    p = ngx_strlchr(p, last, '-');
+
+    if (p) {
+        min = ngx_atoi(value[3].data, p - value[3].data);
+        max = ngx_atoi(p + 1, last - p - 1);
+
+    } else {
+        min = ngx_atoi(value[3].data, value[3].len);
+        max = min;
+    }
+
+    if (min == NGX_ERROR || max == NGX_ERROR
+        || min < 1 || max > 65535 || min > max)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid port range \"%V\"", &value[3]);
+        return NGX_CONF_ERROR;
+    }
+
+    cidr->port_min = min;
+    cidr->port_max = max;
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * cors_origin_policy origin name
+ *
+ * The requests from the origin use the policy of the cors_policy block
+ * instead of the one of the location.
+ */
+static char *
+ngx_http_cors_origin_policy(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_int_t                               rc;
+    ngx_str_t                              *value, origin, scheme, host, port;
+    ngx_uint_t                              i;
+    ngx_http_cross_origin_policy_t         *policy;
+    ngx_http_cross_origin_loc_conf_t       *named;
+    ngx_http_cross_origin_main_conf_t      *comcf;
+    ngx_http_cross_origin_origin_policy_t  *op;
+
+    value = cf->args->elts;
+
+    if (value[1].len == 0 || value[1].len > MAX_ORIGIN_LEN) {
+        goto invalid;
+    }
+
+    origin.data = ngx_pnalloc(cf->pool, value[1].len);
+    if (origin.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    rc = ngx_http_cross_origin_parse_origin(origin.data, value[1].data,
+                                            value[1].len, &scheme, &host,
+                                            &port, 0);
+    if (rc == NGX_ERROR) {
+        goto invalid;
+    }
+
+    origin.len = rc;
+
+    comcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cross_origin_module);
+
+    policy = comcf->named.elts;
+
+    for (i = 0; i < comcf->named.nelts; i++) {
+        if (policy[i].name.len == value[2].len
+            && ngx_strncmp(policy[i].name.data, value[2].data,
+                           value[2].len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (i == comcf->named.nelts) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "unknown cors policy \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    named = policy[i].conf->policy;
+
+    if (named == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "cors policy \"%V\" is not enabled", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (colcf->origin_policy_list == NULL) {
+        colcf->origin_policy_list = ngx_array_create(cf->pool, 4,
+                                sizeof(ngx_http_cross_origin_origin_policy_t));
+        if (colcf->origin_policy_list == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    op = colcf->origin_policy_list->elts;
+
+    for (i = 0; i < colcf->origin_policy_list->nelts; i++) {
+        if (op[i].origin.len == origin.len
+            && ngx_strncmp(op[i].origin.data, origin.data, origin.len) == 0)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "duplicate origin \"%V\" in "
+                               "cors_origin_policy", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    op = ngx_array_push(colcf->origin_policy_list);
+    if (op == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    op->conf = named;
+    op->origin = origin;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid origin \"%V\", only an exact origin "
+                       "can be mapped to a policy", &value[1]);
+    return NGX_CONF_ERROR;
+}
+
+
+/* cors_origin_allowed $variable */
+static char *
+ngx_http_cors_origin_allowed(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_str_t                         *value, name;
+
+    if (colcf->origin_variable != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len < 2 || value[1].data[0] != '$') {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid variable name \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len = value[1].len - 1;
+    name.data = value[1].data + 1;
+
+    colcf->origin_variable = ngx_http_get_variable_index(cf, &name);
+
+    if (colcf->origin_variable == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/* cors_api name, the zone is defined by cors_origin_zone */
+static char *
+ngx_http_cors_api(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_str_t                 *value;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (colcf->api) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    colcf->api = ngx_http_cross_origin_add_origin_zone(cf, &value[1], 0);
+    if (colcf->api == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_cross_origin_api_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_shm_zone_t *
+ngx_http_cross_origin_add_origin_zone(ngx_conf_t *cf, ngx_str_t *name,
+        size_t size)
+{
+    ngx_shm_zone_t                     *shm_zone, **zp;
+    ngx_http_cross_origin_zone_t       *zone;
+    ngx_http_cross_origin_main_conf_t  *comcf;
+
+    shm_zone = ngx_shared_memory_add(cf, name, size,
+                                     &ngx_http_cross_origin_module);
+    if (shm_zone == NULL) {
+        return NULL;
+    }
+
+    if (shm_zone->data == NULL) {
+        zone = ngx_pcalloc(cf->pool, sizeof(ngx_http_cross_origin_zone_t));
+        if (zone == NULL) {
+            return NULL;
+        }
+
+        shm_zone->init = ngx_http_cross_origin_init_origin_zone;
+        shm_zone->data = zone;
+
+        comcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cross_origin_module);
+
+        zp = ngx_array_push(&comcf->zones);
+        if (zp == NULL) {
+            return NULL;
+        }
+
+        *zp = shm_zone;
+
+    } else if (shm_zone->init != ngx_http_cross_origin_init_origin_zone) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the zone \"%V\" is already used by another "
+                           "directive", name);
+        return NULL;
+    }
+
+    return shm_zone;
+}
+
+
+static char *
+ngx_http_cors_method_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i, method;
+    ngx_http_cross_origin_val_t       *cov;
+
+    value = cf->args->elts;
+
+    if (colcf->method_list == NULL) {
+        colcf->method_list = ngx_array_create(cf->pool, 4,
+                                        sizeof(ngx_http_cross_origin_val_t));
+        if (colcf->method_list == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "unbounded") == 0) {
+            colcf->method_unbounded = 1;
+            break;
+        }
+
+        cov = ngx_array_push(colcf->method_list);
+        if (cov == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        method = ngx_http_cross_origin_get_method(&value[i]);
+        if (method == NGX_HTTP_UNKNOWN) {
+            return NGX_CONF_ERROR;
+        }
+
+        colcf->methods |= method;
+        colcf->safe_methods |= method;
+
+        cov->hash = ngx_hash_key(value[i].data, value[i].len);
+        cov->value = value[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_cors_header_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_cross_origin_val_t       *cov;
+
+    value = cf->args->elts;
+
+    if (colcf->header_list == NULL) {
+        colcf->header_list = ngx_array_create(cf->pool, 4,
+                                        sizeof(ngx_http_cross_origin_val_t));
+        if (colcf->header_list == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strcmp(value[i].data, "unbounded") == 0) {
+            colcf->header_unbounded = 1;
+            break;
+        }
+
+        cov = ngx_array_push(colcf->header_list);
+        if (cov == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cov->hash = ngx_hash_key_lc(value[i].data, value[i].len);
+        cov->value = value[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_cors_safe_methods(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t   *colcf = conf;
+
+    ngx_str_t                          *value;
+    ngx_uint_t                          i, method;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        method = ngx_http_cross_origin_get_method(&value[i]);
+        if (method == NGX_HTTP_UNKNOWN) {
+            return NGX_CONF_ERROR;
+        }
+
+        colcf->safe_methods |= method;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_cors_expose_header_list(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_cross_origin_val_t       *cov;
+
+    value = cf->args->elts;
+
+    if (colcf->expose_header_list == NULL) {
+        colcf->expose_header_list = ngx_array_create(cf->pool, 4,
+                                        sizeof(ngx_http_cross_origin_val_t));
+        if (colcf->expose_header_list == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_http_cross_origin_search_string(simple_response_headers, 
+                    &value[i], 1)) {
+            continue;
+        }
 
         cov = ngx_array_push(colcf->expose_header_list);
         if (cov == NULL) {
             return NGX_CONF_ERROR;
         }
 
-        cov->hash = ngx_hash_key_lc(value[i].data, value[i].len);
-        cov->value = value[i];
+        cov->hash = ngx_hash_key_lc(value[i].data, value[i].len);
+        cov->value = value[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_cors_preflight_response(ngx_conf_t *cf, ngx_command_t *cmd, 
+        void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (colcf->preflight_response.value.len != 0) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+    ccv.cf = cf;
+    ccv.value = &value[1];
+    ccv.complex_value = &colcf->preflight_response;
+
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_cors_reject_preflight(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    ngx_int_t                          status;
+    ngx_str_t                         *value;
+
+    if (colcf->reject_preflight != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcasecmp(value[1].data, (u_char *) "on") == 0) {
+        colcf->reject_preflight = 1;
+
+    } else if (ngx_strcasecmp(value[1].data, (u_char *) "off") == 0) {
+        colcf->reject_preflight = 0;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be \"on\" or \"off\"",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (cf->args->nelts == 2) {
+        colcf->reject_status = NGX_HTTP_FORBIDDEN;
+        return NGX_CONF_OK;
+    }
+
+    status = ngx_atoi(value[2].data, value[2].len);
+
+    if (status < 200 || status > 599) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid status \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    colcf->reject_status = status;
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * cors_decision_cache zone=name[:size] [max=number] [inactive=time] | off
+ *
+ * The zone can be defined once with its size and used by its name only
+ * in the other places.
+ */
+static char *
+ngx_http_cors_decision_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+
+    u_char                            *p;
+    ssize_t                            size, max;
+    time_t                             inactive;
+    ngx_str_t                         *value, name, s;
+    ngx_uint_t                         i;
+    ngx_shm_zone_t                    *shm_zone;
+    ngx_http_cross_origin_cache_t     *cache;
+
+    if (colcf->decision_cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+
+        if (cf->args->nelts != 2) {
+            return "has invalid parameters with \"off\"";
+        }
+
+        colcf->decision_cache = NULL;
+        return NGX_CONF_OK;
+    }
+
+    name.len = 0;
+    size = 0;
+    max = NGX_CONF_UNSET;
+    inactive = NGX_CONF_UNSET;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p) {
+                name.len = p - name.data;
+
+                s.data = p + 1;
+                s.len = value[i].data + value[i].len - s.data;
+
+                size = ngx_parse_size(&s);
+
+                if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+                    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                       "invalid zone size \"%V\"", &value[i]);
+                    return NGX_CONF_ERROR;
+                }
+
+            } else {
+                name.len = value[i].len - 5;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            s.data = value[i].data + 4;
+            s.len = value[i].len - 4;
+
+            max = ngx_parse_size(&s);
+
+            if (max == NGX_ERROR || max == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
+
+            s.data = value[i].data + 9;
+            s.len = value[i].len - 9;
+
+            inactive = ngx_parse_time(&s, 1);
+
+            if (inactive == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid inactive value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    if (size == 0 && (max != NGX_CONF_UNSET || inactive != NGX_CONF_UNSET)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the size of the zone \"%V\" must be set with "
+                           "the \"max\" and \"inactive\" parameters",
+                           &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_cross_origin_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data
+        && shm_zone->init != ngx_http_cross_origin_init_cache_zone)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the zone \"%V\" is already used by another "
+                           "directive", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    cache = shm_zone->data;
+
+    if (cache == NULL) {
+        cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_cross_origin_cache_t));
+        if (cache == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->inactive = 600;
+
+        shm_zone->init = ngx_http_cross_origin_init_cache_zone;
+        shm_zone->data = cache;
+    }
+
+    if (size) {
+
+        if (cache->defined) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the decision cache zone \"%V\" is "
+                               "already defined", &name);
+            return NGX_CONF_ERROR;
+        }
+
+        cache->defined = 1;
+
+        if (max != NGX_CONF_UNSET) {
+            cache->max = max;
+        }
+
+        if (inactive != NGX_CONF_UNSET) {
+            cache->inactive = inactive;
+        }
+    }
+
+    colcf->decision_cache = shm_zone;
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * The memory of the zone is kept over a reload if its size is not
+ * changed, then only its generation is bumped.
+ */
+static ngx_int_t
+ngx_http_cross_origin_init_cache_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_cross_origin_cache_t  *ocache = data;
+
+    size_t                          len;
+    ngx_http_cross_origin_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        cache->generation = ++cache->sh->generation;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        cache->generation = cache->sh->generation;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_cross_origin_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_cross_origin_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    cache->sh->count = 0;
+    cache->sh->generation = 0;
+    cache->generation = 0;
+
+    len = sizeof(" in cors decision cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in cors decision cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+/*
+ * The origins are loaded when the zone is created, so a missing or bad
+ * file fails the configuration. A zone kept over a reload is checked
+ * again by the first worker timer.
+ */
+static ngx_int_t
+ngx_http_cross_origin_init_file_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_cross_origin_file_t  *ofile = data;
+
+    size_t                         len;
+    ngx_http_cross_origin_file_t  *file;
+
+    file = shm_zone->data;
+
+    if (ofile) {
+        file->sh = ofile->sh;
+        file->shpool = ofile->shpool;
+        file->sh->next_check = 0;
+
+        return NGX_OK;
+    }
+
+    file->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        file->sh = file->shpool->data;
+
+        return NGX_OK;
+    }
+
+    file->sh = ngx_slab_alloc(file->shpool,
+                              sizeof(ngx_http_cross_origin_file_sh_t));
+    if (file->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(file->sh, sizeof(ngx_http_cross_origin_file_sh_t));
+
+    file->shpool->data = file->sh;
+
+    len = sizeof(" in cors origin file zone \"\"") + shm_zone->shm.name.len;
+
+    file->shpool->log_ctx = ngx_slab_alloc(file->shpool, len);
+    if (file->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(file->shpool->log_ctx, " in cors origin file zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    if (ngx_http_cross_origin_file_update(file, shm_zone->shm.log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    file->sh->next_check = ngx_time() + file->interval;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_cross_origin_file_handler(ngx_event_t *ev)
+{
+    ngx_http_cross_origin_file_t  *file = ev->data;
+
+    ngx_flag_t                     update;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    /* one worker checks the file in an interval */
+    if (ngx_shmtx_trylock(&file->shpool->mutex)) {
+
+        if (ngx_time() >= file->sh->next_check) {
+            file->sh->next_check = ngx_time() + file->interval;
+            update = 1;
+
+        } else {
+            update = 0;
+        }
+
+        ngx_shmtx_unlock(&file->shpool->mutex);
+
+        if (update) {
+            /* a failed update keeps the published origins */
+            (void) ngx_http_cross_origin_file_update(file, ev->log);
+        }
+    }
+
+    ngx_add_timer(ev, file->interval * 1000);
+}
+
+
+/* The origins of the zone are kept over a reload */
+static ngx_int_t
+ngx_http_cross_origin_init_origin_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_cross_origin_zone_t  *ozone = data;
+
+    size_t                         len;
+    ngx_http_cross_origin_zone_t  *zone;
+
+    zone = shm_zone->data;
+
+    if (ozone) {
+        zone->sh = ozone->sh;
+        zone->shpool = ozone->shpool;
+
+        return NGX_OK;
+    }
+
+    zone->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        zone->sh = zone->shpool->data;
+
+        return NGX_OK;
+    }
+
+    zone->sh = ngx_slab_alloc(zone->shpool,
+                              sizeof(ngx_http_cross_origin_sets_t));
+    if (zone->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(zone->sh, sizeof(ngx_http_cross_origin_sets_t));
+
+    zone->shpool->data = zone->sh;
+
+    len = sizeof(" in cors origin zone \"\"") + shm_zone->shm.name.len;
+
+    zone->shpool->log_ctx = ngx_slab_alloc(zone->shpool, len);
+    if (zone->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(zone->shpool->log_ctx, " in cors origin zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+/*
+ * Add or remove a lowercased origin by publishing a changed copy of the
+ * current set. Only the other writers wait for the mutex, the lookups
+ * keep using the current set meanwhile. NGX_DECLINED if there is nothing
+ * to change, NGX_ERROR if the zone is full.
+ */
+static ngx_int_t
+ngx_http_cross_origin_zone_update(ngx_http_cross_origin_zone_t *zone,
+        u_char *name, size_t len, ngx_flag_t add)
+{
+    u_char                              *data;
+    size_t                               size;
+    uint32_t                             i;
+    ngx_uint_t                           n;
+    ngx_flag_t                           found;
+    ngx_http_cross_origin_set_t         *old, *set;
+    ngx_http_cross_origin_index_slot_t  *slot;
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    old = (ngx_http_cross_origin_set_t *) zone->sh->current;
+
+    found = old && ngx_http_cross_origin_index_find(&old->index, name, len);
+
+    if (found == add) {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_http_cross_origin_sets_reclaim(zone->shpool, zone->sh);
+
+    n = old ? old->nentries : 0;
+    size = old ? old->index.arena_size : 0;
+
+    if (add) {
+        n++;
+        size += len;
+
+    } else {
+        n--;
+        size -= len;
+    }
+
+    set = ngx_http_cross_origin_set_create(zone->shpool, n, size);
+    if (set == NULL) {
+        ngx_shmtx_unlock(&zone->shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    for (i = 0; old && i <= old->index.mask; i++) {
+
+        slot = &old->index.slots[i];
+
+        if (slot->len == 0) {
+            continue;
+        }
+
+        data = old->index.arena + slot->offset;
+
+        if (!add && slot->len == len && ngx_memcmp(data, name, len) == 0) {
+            continue;
+        }
+
+        (void) ngx_http_cross_origin_set_add(set, data, slot->len);
+    }
+
+    if (add) {
+        (void) ngx_http_cross_origin_set_add(set, name, len);
+    }
+
+    ngx_http_cross_origin_sets_publish(zone->sh, set);
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+/*
+ * GET lists the origins of the zone one per line, or only the one of the
+ * "origin" argument if it is there. POST adds the origin, DELETE removes
+ * it. Only the clients of the local host are served.
+ */
+static ngx_int_t
+ngx_http_cross_origin_api_handler(ngx_http_request_t *r)
+{
+    u_char                            *dst, *src;
+    u_char                             buf[MAX_ORIGIN_LEN];
+    ngx_int_t                          rc, len;
+    ngx_str_t                          arg, origin, scheme, host, port;
+    ngx_http_complex_value_t           cv;
+    ngx_http_cross_origin_zone_t      *zone;
+    ngx_http_cross_origin_loc_conf_t  *colcf;
+
+    if (!ngx_http_cross_origin_api_local(r->connection)) {
+        return NGX_HTTP_FORBIDDEN;
+    }
+
+    if (!(r->method
+          & (NGX_HTTP_GET|NGX_HTTP_HEAD|NGX_HTTP_POST|NGX_HTTP_DELETE)))
+    {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    colcf = ngx_http_get_module_loc_conf(r, ngx_http_cross_origin_module);
+
+    zone = colcf->api->data;
+
+    origin.len = 0;
+
+    if (ngx_http_arg(r, (u_char *) "origin", 6, &arg) == NGX_OK) {
+
+        origin.data = ngx_pnalloc(r->pool, arg.len);
+        if (origin.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        dst = origin.data;
+        src = arg.data;
+
+        ngx_unescape_uri(&dst, &src, arg.len, 0);
+
+        origin.len = dst - origin.data;
+
+        if (origin.len == 0 || origin.len > MAX_ORIGIN_LEN) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        len = ngx_http_cross_origin_parse_origin(buf, origin.data,
+                                                 origin.len, &scheme, &host,
+                                                 &port, 0);
+        if (len == NGX_ERROR) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+    } else {
+        len = 0;
+    }
+
+    if (r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD)) {
+
+        if (len == 0) {
+            return ngx_http_cross_origin_api_list(r, zone);
+        }
+
+        if (!ngx_http_cross_origin_sets_find(zone->sh, buf, len)) {
+            return NGX_HTTP_NOT_FOUND;
+        }
+
+        ngx_memzero(&cv, sizeof(ngx_http_complex_value_t));
+
+        cv.value.data = ngx_pnalloc(r->pool, len + 1);
+        if (cv.value.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        dst = ngx_cpymem(cv.value.data, buf, len);
+        *dst++ = LF;
+
+        cv.value.len = dst - cv.value.data;
+
+        return ngx_http_send_response(r, NGX_HTTP_OK, &api_content_type, &cv);
+    }
+
+    if (len == 0) {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    rc = ngx_http_cross_origin_zone_update(zone, buf, len,
+                                           r->method == NGX_HTTP_POST);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http cross origin api \"%V\": %i", &origin, rc);
+
+    switch (rc) {
+
+    case NGX_OK:
+        return (r->method == NGX_HTTP_POST) ? NGX_HTTP_CREATED
+                                            : NGX_HTTP_NO_CONTENT;
+
+    case NGX_DECLINED:
+        return (r->method == NGX_HTTP_POST) ? NGX_HTTP_NO_CONTENT
+                                            : NGX_HTTP_NOT_FOUND;
+
+    default:
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cors origin zone is full, \"%V\" is not added",
+                      &origin);
+
+        return NGX_HTTP_INSUFFICIENT_STORAGE;
+    }
+}
+
+
+static ngx_flag_t
+ngx_http_cross_origin_api_local(ngx_connection_t *c)
+{
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (c->sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) c->sockaddr;
+        return IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr);
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return 1;
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) c->sockaddr;
+        return (ntohl(sin->sin_addr.s_addr) >> 24) == 127;
+
+    default:
+        return 0;
+    }
+}
+
+
+/*
+ * The set is copied with the mutex locked, so a change can not replace
+ * and free it meanwhile. The lookups never wait for it, they do not lock.
+ */
+static ngx_int_t
+ngx_http_cross_origin_api_list(ngx_http_request_t *r,
+        ngx_http_cross_origin_zone_t *zone)
+{
+    u_char                              *p;
+    uint32_t                             i;
+    ngx_http_complex_value_t             cv;
+    ngx_http_cross_origin_set_t         *set;
+    ngx_http_cross_origin_index_slot_t  *slot;
+
+    ngx_memzero(&cv, sizeof(ngx_http_complex_value_t));
+
+    ngx_shmtx_lock(&zone->shpool->mutex);
+
+    set = (ngx_http_cross_origin_set_t *) zone->sh->current;
+
+    if (set && set->nentries) {
+
+        p = ngx_pnalloc(r->pool, set->index.arena_size + set->nentries);
+        if (p == NULL) {
+            ngx_shmtx_unlock(&zone->shpool->mutex);
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        cv.value.data = p;
+
+        for (i = 0; i <= set->index.mask; i++) {
+
+            slot = &set->index.slots[i];
+
+            if (slot->len == 0) {
+                continue;
+            }
+
+            p = ngx_cpymem(p, set->index.arena + slot->offset, slot->len);
+            *p++ = LF;
+        }
+
+        cv.value.len = p - cv.value.data;
+    }
+
+    ngx_shmtx_unlock(&zone->shpool->mutex);
+
+    return ngx_http_send_response(r, NGX_HTTP_OK, &api_content_type, &cv);
+}
+
+
+/*
+ * Rebuild the origins if the file is changed. The file is replaced by
+ * renaming, so its inode, size or time tells the change. It is read and
+ * parsed in the memory of the process, the mutex of the zone is only
+ * locked to copy the new set into the zone and publish it.
+ */
+static ngx_int_t
+ngx_http_cross_origin_file_update(ngx_http_cross_origin_file_t *file,
+        ngx_log_t *log)
+{
+    u_char                           *buf;
+    size_t                            size;
+    ssize_t                           n;
+    ngx_fd_t                          fd;
+    ngx_uint_t                        i;
+    ngx_file_info_t                   fi;
+    ngx_http_cross_origin_set_t      *set, *copy;
+    ngx_http_cross_origin_file_sh_t  *sh;
+
+    sh = file->sh;
+    set = NULL;
+
+    fd = ngx_open_file(file->path.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      ngx_open_file_n " \"%V\" failed", &file->path);
+        return NGX_ERROR;
+    }
+
+    buf = NULL;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      ngx_fd_info_n " \"%V\" failed", &file->path);
+        goto failed;
+    }
+
+    if (sh->sets.current
+        && sh->mtime == ngx_file_mtime(&fi)
+        && sh->size == ngx_file_size(&fi)
+        && sh->uniq == ngx_file_uniq(&fi))
+    {
+        goto done;
+    }
+
+    size = ngx_file_size(&fi);
+
+    if (size > (size_t) (file->shpool->end - file->shpool->start)) {
+        ngx_log_error(NGX_LOG_EMERG, log, 0,
+                      "cors origin file \"%V\" is too large for its zone",
+                      &file->path);
+        goto failed;
+    }
+
+    buf = ngx_alloc(size + 1, log);
+    if (buf == NULL) {
+        goto failed;
+    }
+
+    for (i = 0; i < size; i += n) {
+
+        n = ngx_read_fd(fd, buf + i, size - i);
+
+        if (n == -1) {
+            ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                          ngx_read_fd_n " \"%V\" failed", &file->path);
+            goto failed;
+        }
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    set = ngx_http_cross_origin_file_build(file, buf, buf + i, log);
+    if (set == NULL) {
+        goto failed;
+    }
+
+    ngx_shmtx_lock(&file->shpool->mutex);
+
+    ngx_http_cross_origin_sets_reclaim(file->shpool, &sh->sets);
+
+    copy = ngx_http_cross_origin_set_copy(file->shpool, set);
+    if (copy == NULL) {
+        ngx_shmtx_unlock(&file->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_EMERG, log, 0,
+                      "cors origin file \"%V\" does not fit in its zone",
+                      &file->path);
+        goto failed;
+    }
+
+    ngx_http_cross_origin_sets_publish(&sh->sets, copy);
+
+    sh->mtime = ngx_file_mtime(&fi);
+    sh->size = ngx_file_size(&fi);
+    sh->uniq = ngx_file_uniq(&fi);
+
+    ngx_shmtx_unlock(&file->shpool->mutex);
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "cors origin file \"%V\" loaded, %ui origins, "
+                  "generation %ui", &file->path, copy->nentries,
+                  copy->generation);
+
+done:
+
+    ngx_free(set);
+    ngx_free(buf);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file->path);
+    }
+
+    return NGX_OK;
+
+failed:
+
+    ngx_free(set);
+    ngx_free(buf);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%V\" failed", &file->path);
+    }
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * The origins one per line like the input of util/cors-origin-index.pl,
+ * the empty lines and the ones starting with "#" are skipped. The lines
+ * are counted by the first pass and added by the second one to a set
+ * allocated from the heap, it is copied into the zone when published.
+ */
+static ngx_http_cross_origin_set_t *
+ngx_http_cross_origin_file_build(ngx_http_cross_origin_file_t *file,
+        u_char *p, u_char *last, ngx_log_t *log)
+{
+    u_char                       *start, *end, *next;
+    u_char                        buf[MAX_ORIGIN_LEN];
+    size_t                        size, total;
+    uint32_t                      nslots;
+    ngx_int_t                     len;
+    ngx_str_t                     scheme, host, port;
+    ngx_uint_t                    pass, n;
+    ngx_http_cross_origin_set_t  *set;
+
+    set = NULL;
+    n = 0;
+    size = 0;
+
+    for (pass = 0; pass < 2; pass++) {
+
+        for (start = p; start < last; start = next) {
+
+            end = ngx_http_cross_origin_find_char(start, last, LF);
+            next = (end < last) ? end + 1 : last;
+
+            while (start < end && (*start == ' ' || *start == '\t')) {
+                start++;
+            }
+
+            while (end > start
+                   && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == CR))
+            {
+                end--;
+            }
+
+            len = end - start;
+
+            if (len == 0 || *start == '#') {
+                continue;
+            }
+
+            if (len > MAX_ORIGIN_LEN) {
+                if (pass == 0) {
+                    ngx_log_error(NGX_LOG_WARN, log, 0,
+                                  "cors origin file \"%V\" has an origin "
+                                  "longer than %d, skipped",
+                                  &file->path, MAX_ORIGIN_LEN);
+                }
+
+                continue;
+            }
+
+            len = ngx_http_cross_origin_parse_origin(buf, start, len,
+                                                     &scheme, &host, &port,
+                                                     0);
+            if (len == NGX_ERROR) {
+                if (pass == 0) {
+                    ngx_log_error(NGX_LOG_WARN, log, 0,
+                                  "cors origin file \"%V\" has an invalid "
+                                  "origin \"%*s\", skipped", &file->path,
+                                  (size_t) (end - start), start);
+                }
+
+                continue;
+            }
+
+            if (pass == 0) {
+                n++;
+                size += len;
+                continue;
+            }
+
+            (void) ngx_http_cross_origin_set_add(set, buf, len);
+        }
+
+        if (pass == 0) {
+            total = ngx_http_cross_origin_set_size(n, size, &nslots);
+
+            set = ngx_alloc(total, log);
+            if (set == NULL) {
+                return NULL;
+            }
+
+            ngx_http_cross_origin_set_init(set, nslots, total);
+        }
+    }
+
+    return set;
+}
+
+
+/*
+ * The bytes of a set for n origins of size bytes in all. At most half of
+ * its slots are used.
+ */
+static size_t
+ngx_http_cross_origin_set_size(ngx_uint_t n, size_t size, uint32_t *nslots)
+{
+    for (*nslots = 1; *nslots < 2 * n; *nslots <<= 1) { /* void */ }
+
+    return sizeof(ngx_http_cross_origin_set_t)
+           + *nslots * sizeof(ngx_http_cross_origin_index_slot_t) + size;
+}
+
+
+static void
+ngx_http_cross_origin_set_init(ngx_http_cross_origin_set_t *set,
+        uint32_t nslots, size_t total)
+{
+    ngx_memzero(set, sizeof(ngx_http_cross_origin_set_t)
+                     + nslots * sizeof(ngx_http_cross_origin_index_slot_t));
+
+    set->index.slots = (ngx_http_cross_origin_index_slot_t *) (set + 1);
+    set->index.mask = nslots - 1;
+    set->index.arena = (u_char *) (set->index.slots + nslots);
+    set->size = total;
+}
+
+
+/* An empty set for n origins of size bytes in all, with the mutex locked */
+static ngx_http_cross_origin_set_t *
+ngx_http_cross_origin_set_create(ngx_slab_pool_t *shpool, ngx_uint_t n,
+        size_t size)
+{
+    size_t                        total;
+    uint32_t                      nslots;
+    ngx_http_cross_origin_set_t  *set;
+
+    total = ngx_http_cross_origin_set_size(n, size, &nslots);
+
+    set = ngx_slab_alloc_locked(shpool, total);
+    if (set == NULL) {
+        return NULL;
+    }
+
+    ngx_http_cross_origin_set_init(set, nslots, total);
+
+    return set;
+}
+
+
+/*
+ * Copy a set built in the memory of the process into the zone, with the
+ * mutex locked. The pointers of the copy are set to its own slots and
+ * arena.
+ */
+static ngx_http_cross_origin_set_t *
+ngx_http_cross_origin_set_copy(ngx_slab_pool_t *shpool,
+        ngx_http_cross_origin_set_t *set)
+{
+    ngx_http_cross_origin_set_t  *copy;
+
+    copy = ngx_slab_alloc_locked(shpool, set->size);
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    ngx_memcpy(copy, set, set->size);
+
+    copy->index.slots = (ngx_http_cross_origin_index_slot_t *) (copy + 1);
+    copy->index.arena = (u_char *) (copy->index.slots
+                                    + copy->index.mask + 1);
+
+    return copy;
+}
+
+
+/*
+ * Add a lowercased origin to a set created large enough for it, the set
+ * is not published yet. NGX_DECLINED if it is there already.
+ */
+static ngx_int_t
+ngx_http_cross_origin_set_add(ngx_http_cross_origin_set_t *set, u_char *name,
+        size_t len)
+{
+    uint32_t                             hash, i;
+    ngx_http_cross_origin_index_t       *index;
+    ngx_http_cross_origin_index_slot_t  *slot;
+
+    index = &set->index;
+
+    hash = ngx_http_cross_origin_index_hash(name, len);
+
+    for (i = hash & index->mask; /* void */ ; i = (i + 1) & index->mask) {
+
+        slot = &index->slots[i];
+
+        if (slot->len == 0) {
+            break;
+        }
+
+        if (slot->hash == hash && slot->len == len
+            && ngx_memcmp(index->arena + slot->offset, name, len) == 0)
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+    ngx_memcpy(index->arena + index->arena_size, name, len);
+
+    slot->hash = hash;
+    slot->offset = index->arena_size;
+    slot->len = len;
+
+    index->arena_size += len;
+    set->nentries++;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Make the set current, with the mutex of the zone locked. The generation
+ * is stored after the set, so a decision remembered under a generation is
+ * never made with an older set.
+ */
+static void
+ngx_http_cross_origin_sets_publish(ngx_http_cross_origin_sets_t *sets,
+        ngx_http_cross_origin_set_t *set)
+{
+    ngx_http_cross_origin_set_t  *old;
+
+    set->generation = sets->generation + 1;
+
+    /* the set is complete before the readers can find it */
+    ngx_memory_barrier();
+
+    old = (ngx_http_cross_origin_set_t *) sets->current;
+    sets->current = (ngx_atomic_uint_t) set;
+
+    ngx_memory_barrier();
+
+    sets->generation = set->generation;
+
+    if (old) {
+        old->retired = set->generation;
+        old->next = sets->retired;
+        sets->retired = old;
+    }
+}
+
+
+/* Free the replaced sets no lookup can be using, with the mutex locked */
+static void
+ngx_http_cross_origin_sets_reclaim(ngx_slab_pool_t *shpool,
+        ngx_http_cross_origin_sets_t *sets)
+{
+    ngx_uint_t                    i, oldest;
+    ngx_atomic_uint_t             reader;
+    ngx_http_cross_origin_set_t  *set, **prev;
+
+    if (sets->retired == NULL) {
+        return;
+    }
+
+    /* the readers noted after the last swap are seen */
+    ngx_memory_barrier();
+
+    oldest = sets->generation;
+
+    for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+        reader = sets->readers[i];
+
+        if (reader && reader - 1 < oldest) {
+            oldest = reader - 1;
+        }
+    }
+
+    prev = &sets->retired;
+
+    for (set = sets->retired; set; set = *prev) {
+
+        if (set->retired > oldest) {
+            prev = &set->next;
+            continue;
+        }
+
+        *prev = set->next;
+        ngx_slab_free_locked(shpool, set);
+    }
+}
+
+
+/*
+ * An origin mapped to a policy is allowed by the mapping itself, so it
+ * gets a copy of the policy with the origin matching left out. The origins
+ * mapped to the same policy share the copy. The handling of the rejected
+ * preflights, the decision cache and, unless the policy has its own, the
+ * exposed headers stay the ones of the location.
+ */
+static ngx_hash_t *
+ngx_http_cross_origin_init_origin_policies(ngx_conf_t *cf,
+        ngx_http_cross_origin_loc_conf_t *conf)
+{
+    size_t                                  len, bucket_size;
+    ngx_int_t                               rc;
+    ngx_uint_t                              i, j;
+    ngx_hash_t                             *hash;
+    ngx_hash_init_t                         hinit;
+    ngx_hash_keys_arrays_t                  ha;
+    ngx_http_cross_origin_loc_conf_t      **copies;
+    ngx_http_cross_origin_origin_policy_t  *op;
+
+    hash = ngx_pcalloc(cf->pool, sizeof(ngx_hash_t));
+    if (hash == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(&ha, sizeof(ngx_hash_keys_arrays_t));
+
+    ha.pool = cf->pool;
+    ha.temp_pool = cf->temp_pool;
+
+    if (ngx_hash_keys_array_init(&ha, NGX_HASH_SMALL) != NGX_OK) {
+        return NULL;
+    }
+
+    copies = ngx_pcalloc(cf->temp_pool, conf->origin_policy_list->nelts
+                                * sizeof(ngx_http_cross_origin_loc_conf_t *));
+    if (copies == NULL) {
+        return NULL;
+    }
+
+    len = 0;
+    op = conf->origin_policy_list->elts;
+
+    for (i = 0; i < conf->origin_policy_list->nelts; i++) {
+
+        for (j = 0; j < i; j++) {
+            if (op[j].conf == op[i].conf) {
+                copies[i] = copies[j];
+                break;
+            }
+        }
+
+        if (copies[i] == NULL) {
+            copies[i] = ngx_pmemalign(cf->pool,
+                                      sizeof(ngx_http_cross_origin_loc_conf_t),
+                                      ngx_cacheline_size);
+            if (copies[i] == NULL) {
+                return NULL;
+            }
+
+            *copies[i] = *op[i].conf;
+
+            copies[i]->origin_unbounded = 1;
+            copies[i]->origin_variable = NGX_CONF_UNSET;
+            copies[i]->origin_policies = NULL;
+
+            /* a mapped origin is repeated, never answered with "*" */
+            copies[i]->origin_policy_list = conf->origin_policy_list;
+            copies[i]->policy = copies[i];
+
+            copies[i]->reject_preflight = conf->reject_preflight;
+            copies[i]->reject_status = conf->reject_status;
+            copies[i]->preflight_early = conf->preflight_early;
+            copies[i]->decision_cache = conf->decision_cache;
+
+            if (copies[i]->expose_header_list == NULL) {
+                copies[i]->expose_header_list = conf->expose_header_list;
+                copies[i]->expose_headers = conf->expose_headers;
+            }
+
+            ngx_http_cross_origin_choose_variants(copies[i]);
+        }
+
+        rc = ngx_hash_add_key(&ha, &op[i].origin, copies[i],
+                              NGX_HASH_READONLY_KEY);
+
+        if (rc != NGX_OK) {
+            return NULL;
+        }
+
+        if (op[i].origin.len > len) {
+            len = op[i].origin.len;
+        }
+    }
+
+    bucket_size = conf->origin_hash_bucket_size;
+
+    if (bucket_size == NGX_CONF_UNSET_UINT) {
+        bucket_size = ngx_max(ngx_cacheline_size,
+                              2 * sizeof(void *)
+                              + ngx_align(len + 2, sizeof(void *)));
+    }
+
+    hinit.hash = hash;
+    hinit.key = ngx_hash_key_lc;
+    hinit.max_size = conf->origin_hash_max_size;
+    hinit.bucket_size = ngx_align(bucket_size, ngx_cacheline_size);
+    hinit.name = "cors_origin_policy_hash";
+    hinit.pool = cf->pool;
+    hinit.temp_pool = NULL;
+
+    if (ngx_hash_init(&hinit, ha.keys.elts, ha.keys.nelts) != NGX_OK) {
+        return NULL;
+    }
+
+    return hash;
+}
+
+
+/*
+ * The shorter networks are added first, so every network can inherit the
+ * entries of the ones containing it.
+ */
+static ngx_http_cross_origin_cidrs_t *
+ngx_http_cross_origin_init_cidrs(ngx_conf_t *cf, ngx_array_t *list)
+{
+    ngx_uint_t                      i;
+    ngx_http_cross_origin_cidr_t   *cidr, **sorted;
+    ngx_http_cross_origin_cidrs_t  *cidrs;
+
+    cidrs = ngx_pcalloc(cf->pool, sizeof(ngx_http_cross_origin_cidrs_t));
+    if (cidrs == NULL) {
+        return NULL;
+    }
+
+    cidrs->tree = ngx_radix_tree_create(cf->pool, -1);
+    if (cidrs->tree == NULL) {
+        return NULL;
+    }
+
+#if (NGX_HAVE_INET6)
+    cidrs->tree6 = ngx_radix_tree_create(cf->pool, -1);
+    if (cidrs->tree6 == NULL) {
+        return NULL;
+    }
+#endif
+
+    sorted = ngx_palloc(cf->temp_pool,
+                        list->nelts * sizeof(ngx_http_cross_origin_cidr_t *));
+    if (sorted == NULL) {
+        return NULL;
+    }
+
+    cidr = list->elts;
+
+    for (i = 0; i < list->nelts; i++) {
+        sorted[i] = &cidr[i];
+    }
+
+    ngx_qsort(sorted, list->nelts, sizeof(ngx_http_cross_origin_cidr_t *),
+              ngx_http_cross_origin_cmp_cidrs);
+
+    for (i = 0; i < list->nelts; i++) {
+        if (ngx_http_cross_origin_add_cidr(cf, cidrs, sorted[i]) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    return cidrs;
+}
+
+
+static ngx_int_t
+ngx_http_cross_origin_add_cidr(ngx_conf_t *cf,
+        ngx_http_cross_origin_cidrs_t *cidrs,
+        ngx_http_cross_origin_cidr_t *cidr)
+{
+    uintptr_t                       value;
+    ngx_int_t                       rc;
+    ngx_array_t                    *entries, *containing;
+    ngx_http_cross_origin_cidr_t  **entry;
+
+#if (NGX_HAVE_INET6)
+    if (cidr->cidr.family == AF_INET6) {
+        value = ngx_radix128tree_find(cidrs->tree6,
+                                      cidr->cidr.u.in6.addr.s6_addr);
+    } else
+#endif
+    {
+        value = ngx_radix32tree_find(cidrs->tree,
+                                     ntohl(cidr->cidr.u.in.addr));
+    }
+
+    containing = (value == NGX_RADIX_NO_VALUE) ? NULL : (ngx_array_t *) value;
+
+    entries = ngx_array_create(cf->pool,
+                               containing ? containing->nelts + 1 : 1,
+                               sizeof(ngx_http_cross_origin_cidr_t *));
+    if (entries == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (containing) {
+        entry = ngx_array_push_n(entries, containing->nelts);
+        if (entry == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(entry, containing->elts,
+                   containing->nelts * sizeof(ngx_http_cross_origin_cidr_t *));
+    }
+
+    entry = ngx_array_push(entries);
+    if (entry == NULL) {
+        return NGX_ERROR;
+    }
+
+    *entry = cidr;
+
+#if (NGX_HAVE_INET6)
+    if (cidr->cidr.family == AF_INET6) {
+        rc = ngx_radix128tree_insert(cidrs->tree6,
+                                     cidr->cidr.u.in6.addr.s6_addr,
+                                     cidr->cidr.u.in6.mask.s6_addr,
+                                     (uintptr_t) entries);
+    } else
+#endif
+    {
+        rc = ngx_radix32tree_insert(cidrs->tree, ntohl(cidr->cidr.u.in.addr),
+                                    ntohl(cidr->cidr.u.in.mask),
+                                    (uintptr_t) entries);
+    }
+
+    if (rc == NGX_BUSY) {
+
+        /* the same network again, the containing entries are its own */
+        entry = ngx_array_push(containing);
+        if (entry == NULL) {
+            return NGX_ERROR;
+        }
+
+        *entry = cidr;
+
+        return NGX_OK;
+    }
+
+    return rc;
+}
+
+
+static ngx_uint_t
+ngx_http_cross_origin_cidr_bits(ngx_http_cross_origin_cidr_t *cidr)
+{
+    u_char      *p;
+    uint32_t     mask;
+    ngx_uint_t   i, bits;
+
+    bits = 0;
+
+#if (NGX_HAVE_INET6)
+    if (cidr->cidr.family == AF_INET6) {
+        p = cidr->cidr.u.in6.mask.s6_addr;
+
+        for (i = 0; i < 16; i++) {
+            for (mask = p[i]; mask; mask &= mask - 1) {
+                bits++;
+            }
+        }
+
+        return bits;
+    }
+#endif
+
+    for (mask = cidr->cidr.u.in.mask; mask; mask &= mask - 1) {
+        bits++;
+    }
+
+    return bits;
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_cross_origin_cmp_cidrs(const void *one, const void *two)
+{
+    ngx_http_cross_origin_cidr_t  **first, **second;
+
+    first = (ngx_http_cross_origin_cidr_t **) one;
+    second = (ngx_http_cross_origin_cidr_t **) two;
+
+    return (int) ngx_http_cross_origin_cidr_bits(*first)
+           - (int) ngx_http_cross_origin_cidr_bits(*second);
+}
+
+
+static ngx_http_cross_origin_origins_t *
+ngx_http_cross_origin_init_origins(ngx_conf_t *cf, ngx_array_t *list,
+    ngx_uint_t max_size, ngx_uint_t bucket_size)
+{
+    size_t                             len;
+    ngx_int_t                          rc;
+    ngx_uint_t                         i;
+    ngx_str_t                         *pattern;
+    ngx_array_t                        hosts, regex, regex_caseless;
+    ngx_hash_init_t                    hinit;
+    ngx_hash_combined_t               *hash;
+    ngx_hash_keys_arrays_t             ha;
+    ngx_http_cross_origin_val_t       *cov;
+    ngx_http_cross_origin_origins_t   *origins;
+
+    origins = ngx_pcalloc(cf->pool, sizeof(ngx_http_cross_origin_origins_t));
+    if (origins == NULL) {
+        return NULL;
+    }
+
+    hash = &origins->hash;
+
+    ngx_memzero(&ha, sizeof(ngx_hash_keys_arrays_t));
+
+    ha.pool = cf->pool;
+    ha.temp_pool = cf->temp_pool;
+
+    if (ngx_hash_keys_array_init(&ha, list->nelts > 1000 ? NGX_HASH_LARGE
+                                                         : NGX_HASH_SMALL)
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&hosts, cf->temp_pool, 4,
+                       sizeof(ngx_http_cross_origin_wildcard_host_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&regex, cf->temp_pool, 1, sizeof(ngx_str_t))
+        != NGX_OK
+        || ngx_array_init(&regex_caseless, cf->temp_pool, 1,
+                          sizeof(ngx_str_t))
+           != NGX_OK)
+    {
+        return NULL;
+    }
+
+    len = 0;
+    cov = list->elts;
+
+    for (i = 0; i < list->nelts; i++) {
+
+        if (cov[i].value.data[0] == '~') {
+
+            if (cov[i].value.len > 1 && cov[i].value.data[1] == '*') {
+                pattern = ngx_array_push(&regex_caseless);
+                if (pattern == NULL) {
+                    return NULL;
+                }
+
+                pattern->len = cov[i].value.len - 2;
+                pattern->data = cov[i].value.data + 2;
+
+            } else {
+                pattern = ngx_array_push(&regex);
+                if (pattern == NULL) {
+                    return NULL;
+                }
+
+                pattern->len = cov[i].value.len - 1;
+                pattern->data = cov[i].value.data + 1;
+            }
+
+            if (pattern->len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "empty regex in cors_origin_list");
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (cov[i].value.len > MAX_ORIGIN_LEN) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "the origin \"%V\" is too long",
+                               &cov[i].value);
+            return NULL;
+        }
+
+        if (ngx_strnstr(cov[i].value.data, "://*.", cov[i].value.len)) {
+            if (ngx_http_cross_origin_add_wildcard(cf, &ha, &hosts,
+                                                   &cov[i].value)
+                != NGX_OK)
+            {
+                return NULL;
+            }
+
+            continue;
+        }
+
+        /* the key is lowercased in place */
+        rc = ngx_hash_add_key(&ha, &cov[i].value, &cov[i], 0);
+
+        if (rc == NGX_ERROR) {
+            return NULL;
+        }
+
+        if (rc == NGX_BUSY) {
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                               "duplicate origin \"%V\" in cors_origin_list",
+                               &cov[i].value);
+            continue;
+        }
+
+        if (cov[i].value.len > len) {
+            len = cov[i].value.len;
+        }
+    }
+
+    if (bucket_size == NGX_CONF_UNSET_UINT) {
+
+        /* make sure that the longest origin fits in a bucket */
+        bucket_size = ngx_max(ngx_cacheline_size,
+                              2 * sizeof(void *)
+                              + ngx_align(len + 2, sizeof(void *)));
+    }
+
+    hinit.key = ngx_hash_key_lc;
+    hinit.max_size = max_size;
+    hinit.bucket_size = ngx_align(bucket_size, ngx_cacheline_size);
+    hinit.name = "cors_origin_hash";
+    hinit.pool = cf->pool;
+
+    if (ha.keys.nelts) {
+        hinit.hash = &hash->hash;
+        hinit.temp_pool = NULL;
+
+        if (ngx_hash_init(&hinit, ha.keys.elts, ha.keys.nelts) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    if (ha.dns_wc_head.nelts) {
+
+        ngx_qsort(ha.dns_wc_head.elts, (size_t) ha.dns_wc_head.nelts,
+                  sizeof(ngx_hash_key_t),
+                  ngx_http_cross_origin_cmp_dns_wildcards);
+
+        hinit.hash = NULL;
+        hinit.temp_pool = cf->temp_pool;
+
+        if (ngx_hash_wildcard_init(&hinit, ha.dns_wc_head.elts,
+                                   ha.dns_wc_head.nelts)
+            != NGX_OK)
+        {
+            return NULL;
+        }
+
+        hash->wc_head = (ngx_hash_wildcard_t *) hinit.hash;
+    }
+
+    if (regex.nelts || regex_caseless.nelts) {
+
+#if (NGX_PCRE)
+        if (ngx_http_cross_origin_compile_regex(cf, origins, &regex, 0,
+                                                &origins->regex)
+            != NGX_OK
+            || ngx_http_cross_origin_compile_regex(cf, origins,
+                                                   &regex_caseless,
+                                                   NGX_REGEX_CASELESS,
+                                                   &origins->regex_caseless)
+               != NGX_OK)
+        {
+            return NULL;
+        }
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "using regex in cors_origin_list "
+                           "requires PCRE library");
+        return NULL;
+#endif
+    }
+
+    return origins;
+}
+
+
+#if (NGX_PCRE)
+
+/*
+ * The patterns are joined to a single alternation, so that a request origin
+ * is matched with only one pass. The groups are numbered anew in it, so the
+ * patterns with back references are compiled and matched alone instead.
+ * Only when the alternation fails, the patterns are compiled one by one to
+ * tell which one is wrong.
+ */
+static ngx_int_t
+ngx_http_cross_origin_compile_regex(ngx_conf_t *cf,
+    ngx_http_cross_origin_origins_t *origins, ngx_array_t *patterns,
+    ngx_int_t options, ngx_regex_t **regex)
+{
+    u_char                *p;
+    size_t                 len;
+    ngx_uint_t             i, n;
+    ngx_str_t             *pattern, *last;
+    ngx_regex_t          **re;
+    ngx_regex_compile_t    rc;
+    u_char                 errstr[NGX_MAX_CONF_ERRSTR];
+
+    pattern = patterns->elts;
+    last = NULL;
+    len = 0;
+    n = 0;
+
+    for (i = 0; i < patterns->nelts; i++) {
+
+        if (!ngx_http_cross_origin_regex_refers(&pattern[i])) {
+            last = &pattern[i];
+            len += sizeof("(?:)|") - 1 + pattern[i].len;
+            n++;
+            continue;
+        }
+
+        if (origins->regexes == NULL) {
+            origins->regexes = ngx_array_create(cf->pool, 1,
+                                                sizeof(ngx_regex_t *));
+            if (origins->regexes == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        re = ngx_array_push(origins->regexes);
+        if (re == NULL) {
+            return NGX_ERROR;
+        }
+
+        *re = ngx_http_cross_origin_compile_pattern(cf, &pattern[i], options);
+        if (*re == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (n == 0) {
+        return NGX_OK;
+    }
+
+    if (n == 1) {
+        *regex = ngx_http_cross_origin_compile_pattern(cf, last, options);
+        return *regex ? NGX_OK : NGX_ERROR;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = ngx_pnalloc(cf->pool, len);
+    if (rc.pattern.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = rc.pattern.data;
+
+    for (i = 0; i < patterns->nelts; i++) {
+
+        if (ngx_http_cross_origin_regex_refers(&pattern[i])) {
+            continue;
+        }
+
+        if (p != rc.pattern.data) {
+            *p++ = '|';
+        }
+
+        p = ngx_sprintf(p, "(?:%V)", &pattern[i]);
+    }
+
+    rc.pattern.len = p - rc.pattern.data;
+    rc.pool = cf->pool;
+    rc.options = options;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) == NGX_OK) {
+        *regex = rc.regex;
+        return NGX_OK;
+    }
+
+    for (i = 0; i < patterns->nelts; i++) {
+        if (ngx_http_cross_origin_compile_pattern(cf, &pattern[i], options)
+            == NULL)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "%V", &rc.err);
+
+    return NGX_ERROR;
+}
+
+
+/*
+ * Whether the pattern may refer to its own groups, by number or by name.
+ * The named groups are counted too, as their names clash when joined.
+ */
+static ngx_flag_t
+ngx_http_cross_origin_regex_refers(ngx_str_t *pattern)
+{
+    u_char  *p, *last;
+
+    p = pattern->data;
+    last = p + pattern->len;
+
+    for ( /* void */ ; p < last; p++) {
+
+        if (*p == '\\' && p + 1 < last) {
+            p++;
+
+            if ((*p >= '1' && *p <= '9') || *p == 'g' || *p == 'k') {
+                return 1;
+            }
+
+            continue;
+        }
+
+        if (*p != '(' || last - p < 3 || p[1] != '?') {
+            continue;
+        }
+
+        /* the named groups, and the calls of the groups as subroutines */
+
+        if (p[2] == 'P' || p[2] == '\'' || p[2] == '&' || p[2] == 'R'
+            || (p[2] >= '0' && p[2] <= '9')
+            || ((p[2] == '-' || p[2] == '+')
+                && last - p > 3 && p[3] >= '0' && p[3] <= '9')
+            || (p[2] == '<' && last - p > 3 && p[3] != '=' && p[3] != '!'))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static ngx_regex_t *
+ngx_http_cross_origin_compile_pattern(ngx_conf_t *cf, ngx_str_t *pattern,
+    ngx_int_t options)
+{
+    ngx_regex_compile_t  rc;
+    u_char               errstr[NGX_MAX_CONF_ERRSTR];
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern = *pattern;
+    rc.pool = cf->pool;
+    rc.options = options;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    if (ngx_regex_compile(&rc) != NGX_OK) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "%V", &rc.err);
+        return NULL;
+    }
+
+    return rc.regex;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_cross_origin_add_wildcard(ngx_conf_t *cf, ngx_hash_keys_arrays_t *ha,
+    ngx_array_t *hosts, ngx_str_t *origin)
+{
+    ngx_int_t                               rc;
+    ngx_str_t                               scheme, host, port;
+    ngx_uint_t                              i;
+    ngx_http_cross_origin_wildcard_t       *wc;
+    ngx_http_cross_origin_wildcard_host_t  *wh;
+
+    /* canonical already, only split in place */
+    if (ngx_http_cross_origin_parse_origin(origin->data, origin->data,
+                origin->len, &scheme, &host, &port, 1) == NGX_ERROR)
+    {
+        goto invalid;
+    }
+
+    wh = hosts->elts;
+
+    for (i = 0; i < hosts->nelts; i++) {
+        if (wh[i].host.len == host.len
+                && ngx_strncmp(wh[i].host.data, host.data, host.len) == 0)
+        {
+            wh = &wh[i];
+            goto found;
+        }
+    }
+
+    wh = ngx_array_push(hosts);
+    if (wh == NULL) {
+        return NGX_ERROR;
+    }
+
+    wh->host = host;
+
+    wh->origins = ngx_array_create(cf->pool, 1,
+                                   sizeof(ngx_http_cross_origin_wildcard_t));
+    if (wh->origins == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_hash_add_key(ha, &host, wh->origins, NGX_HASH_WILDCARD_KEY);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        goto invalid;
+    }
+
+found:
+
+    wc = ngx_array_push(wh->origins);
+    if (wc == NULL) {
+        return NGX_ERROR;
+    }
+
+    wc->scheme = scheme;
+    wc->port = port;
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid wildcard origin \"%V\"", origin);
+
+    return NGX_ERROR;
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_cross_origin_cmp_dns_wildcards(const void *one, const void *two)
+{
+    ngx_hash_key_t  *first, *second;
+
+    first = (ngx_hash_key_t *) one;
+    second = (ngx_hash_key_t *) two;
+
+    return ngx_dns_strcmp(first->key.data, second->key.data);
+}
+
+
+static ngx_http_cross_origin_headers_t *
+ngx_http_cross_origin_init_headers(ngx_conf_t *cf, ngx_array_t *list)
+{
+    size_t                             len;
+    ngx_int_t                          rc;
+    ngx_str_t                         *s;
+    ngx_uint_t                         i, n, b;
+    uint64_t                          *bits;
+    ngx_hash_init_t                    hinit;
+    ngx_hash_keys_arrays_t             ha;
+    ngx_http_cross_origin_val_t       *cov;
+    ngx_http_cross_origin_headers_t   *hs;
+
+    hs = ngx_pcalloc(cf->pool, sizeof(ngx_http_cross_origin_headers_t));
+    if (hs == NULL) {
+        return NULL;
+    }
+
+    bits = ngx_palloc(cf->pool, MAX_HEADER_BITS * sizeof(uint64_t));
+    if (bits == NULL) {
+        return NULL;
+    }
+
+    ngx_memzero(&ha, sizeof(ngx_hash_keys_arrays_t));
+
+    ha.pool = cf->pool;
+    ha.temp_pool = cf->temp_pool;
+
+    if (ngx_hash_keys_array_init(&ha, NGX_HASH_SMALL) != NGX_OK) {
+        return NULL;
+    }
+
+    n = 0;
+    len = 0;
+
+    for (s = simple_headers; s->len; s++) {
+
+        len = ngx_max(len, s->len);
+        bits[n] = (uint64_t) 1 << n;
+
+        rc = ngx_http_cross_origin_add_header_name(cf, &ha, s, &bits[n]);
+        if (rc == NGX_ERROR) {
+            return NULL;
+        }
+
+        if (rc == NGX_OK) {
+            hs->simple |= bits[n];
+            n++;
+        }
     }
 
-    return NGX_CONF_OK;
+    if (list) {
+        cov = list->elts;
+
+        for (i = 0; i < list->nelts; i++) {
+
+            b = ngx_min(n, MAX_HEADER_BITS - 1);
+
+            len = ngx_max(len, cov[i].value.len);
+            bits[b] = (uint64_t) 1 << b;
+
+            rc = ngx_http_cross_origin_add_header_name(cf, &ha,
+                                                       &cov[i].value, &bits[b]);
+            if (rc == NGX_ERROR) {
+                return NULL;
+            }
+
+            if (rc == NGX_OK && n < MAX_HEADER_BITS) {
+                n++;
+            }
+        }
+    }
+
+    hs->allowed = ((uint64_t) 1 << n) - 1;
+
+    hinit.hash = &hs->hash;
+    hinit.key = ngx_hash_key_lc;
+    hinit.max_size = 512;
+    hinit.bucket_size = ngx_align(2 * sizeof(void *)
+                                  + ngx_align(len + 2, sizeof(void *)),
+                                  ngx_cacheline_size);
+    hinit.name = "cors_header_hash";
+    hinit.pool = cf->pool;
+    hinit.temp_pool = NULL;
+
+    if (ngx_hash_init(&hinit, ha.keys.elts, ha.keys.nelts) != NGX_OK) {
+        return NULL;
+    }
+
+    return hs;
 }
 
 
-static char *
-ngx_http_cors_preflight_response(ngx_conf_t *cf, ngx_command_t *cmd, 
-        void *conf)
+/* The name is lowercased to a copy, it is still used as the header value */
+static ngx_int_t
+ngx_http_cross_origin_add_header_name(ngx_conf_t *cf,
+    ngx_hash_keys_arrays_t *ha, ngx_str_t *name, uint64_t *bit)
 {
-    ngx_http_cross_origin_loc_conf_t  *colcf = conf;
+    ngx_str_t  key;
 
-    ngx_str_t                         *value;
-    ngx_http_compile_complex_value_t   ccv;
+    if (name->len > MAX_HEADER_NAME_LEN) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "the header \"%V\" is too long", name);
+        return NGX_ERROR;
+    }
 
-    if (colcf->preflight_response.value.len != 0) {
-        return "is duplicate";
+    key.len = name->len;
+    key.data = ngx_pnalloc(cf->pool, name->len);
+    if (key.data == NULL) {
+        return NGX_ERROR;
     }
 
-    value = cf->args->elts;
+    ngx_strlow(key.data, name->data, name->len);
 
-    ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+    return ngx_hash_add_key(ha, &key, bit, 0);
+}
 
-    ccv.cf = cf;
-    ccv.value = &value[1];
-    ccv.complex_value = &colcf->preflight_response;
 
-    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
-        return NGX_CONF_ERROR;
+static void *
+ngx_http_cross_origin_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_cross_origin_main_conf_t  *comcf;
+
+    comcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_cross_origin_main_conf_t));
+    if (comcf == NULL) {
+        return NULL;
     }
 
-    return NGX_CONF_OK;
+    if (ngx_array_init(&comcf->named, cf->pool, 4,
+                       sizeof(ngx_http_cross_origin_policy_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&comcf->policies, cf->pool, 4,
+                       sizeof(ngx_http_cross_origin_loc_conf_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&comcf->files, cf->pool, 1, sizeof(ngx_shm_zone_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&comcf->zones, cf->pool, 1, sizeof(ngx_shm_zone_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return comcf;
 }
 
 
@@ -1194,21 +6410,43 @@ ngx_http_cross_origin_create_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->origin_list  = NULL;
+     *     conf->origins  = NULL;
+     *     conf->cidr_list  = NULL;
+     *     conf->cidrs  = NULL;
+     *     conf->origin_policy_list  = NULL;
+     *     conf->origin_policies  = NULL;
      *     conf->method_list  = NULL;
+     *     conf->methods  = 0;
      *     conf->header_list  = NULL;
+     *     conf->headers  = NULL;
      *     conf->safe_methods = 0;
      *     conf->expose_header_list  = NULL;
      *     conf->preflight_response_type  = {0, NULL};
+     *     conf->allow_methods  = {0, NULL};
+     *     conf->allow_headers  = {0, NULL};
+     *     conf->expose_headers  = {0, NULL};
+     *     conf->max_age_value  = {0, NULL};
      *     conf->preflight_response  = ALL NULL;
      *
      */
 
     conf->enable             = NGX_CONF_UNSET;
+    conf->origin_hash_max_size    = NGX_CONF_UNSET_UINT;
+    conf->origin_hash_bucket_size = NGX_CONF_UNSET_UINT;
     conf->origin_unbounded   = NGX_CONF_UNSET;
     conf->method_unbounded   = NGX_CONF_UNSET;
     conf->header_unbounded   = NGX_CONF_UNSET;
     conf->support_credential = NGX_CONF_UNSET;
     conf->max_age            = NGX_CONF_UNSET;
+    conf->reject_preflight   = NGX_CONF_UNSET;
+    conf->reject_status      = NGX_CONF_UNSET_UINT;
+    conf->preflight_early    = NGX_CONF_UNSET;
+    conf->decision_cache     = NGX_CONF_UNSET_PTR;
+    conf->use                = NGX_CONF_UNSET_PTR;
+    conf->origin_index       = NGX_CONF_UNSET_PTR;
+    conf->origin_file        = NGX_CONF_UNSET_PTR;
+    conf->origin_zone        = NGX_CONF_UNSET_PTR;
+    conf->origin_variable    = NGX_CONF_UNSET;
 
     return conf;
 }
@@ -1220,12 +6458,72 @@ ngx_http_cross_origin_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_cross_origin_loc_conf_t *prev = parent;
     ngx_http_cross_origin_loc_conf_t *conf = child;
 
+    ngx_flag_t                        set;
+    ngx_http_cross_origin_loc_conf_t *use;
+
+    set = ngx_http_cross_origin_conf_is_set(conf);
+
+    if (conf->use != NGX_CONF_UNSET_PTR) {
+
+        if (set) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"cors_use\" can not be used with the other "
+                               "cors directives at the same level");
+            return NGX_CONF_ERROR;
+        }
+
+        conf->policy = conf->use->policy;
+        return NGX_CONF_OK;
+    }
+
+    /* the main level configuration is never merged, so check the raw one */
+    use = (prev->use != NGX_CONF_UNSET_PTR) ? prev->use : NULL;
+
+    if (use) {
+
+        if (!set) {
+            conf->use = use;
+            conf->policy = use->policy;
+            return NGX_CONF_OK;
+        }
+
+        /* the own directives are merged with the used policy */
+        prev = use;
+    }
+
+    conf->use = NULL;
+
+    ngx_conf_merge_uint_value(conf->origin_hash_max_size,
+                              prev->origin_hash_max_size, 2048);
+
+    if (conf->origin_hash_bucket_size == NGX_CONF_UNSET_UINT) {
+        conf->origin_hash_bucket_size = prev->origin_hash_bucket_size;
+    }
+
     if (conf->origin_list == NULL) {
         conf->origin_list = prev->origin_list;
     }
 
+    if (conf->cidr_list == NULL) {
+        conf->cidr_list = prev->cidr_list;
+    }
+
+    if (conf->origin_policy_list == NULL) {
+        conf->origin_policy_list = prev->origin_policy_list;
+    }
+
+    ngx_conf_merge_ptr_value(conf->origin_index, prev->origin_index, NULL);
+    ngx_conf_merge_ptr_value(conf->origin_file, prev->origin_file, NULL);
+    ngx_conf_merge_ptr_value(conf->origin_zone, prev->origin_zone, NULL);
+
+    /* NGX_CONF_UNSET stays for no variable */
+    if (conf->origin_variable == NGX_CONF_UNSET) {
+        conf->origin_variable = prev->origin_variable;
+    }
+
     if (conf->method_list == NULL) {
         conf->method_list = prev->method_list;
+        conf->methods = prev->methods;
     }
 
     if (conf->header_list == NULL) {
@@ -1255,8 +6553,432 @@ ngx_http_cross_origin_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_sec_value(conf->max_age, prev->max_age, 0);
     ngx_conf_merge_str_value(conf->preflight_response_type, 
             prev->preflight_response_type, DEFAULT_RESPONSE_CONTENT_TYPE);
+    ngx_conf_merge_ptr_value(conf->decision_cache, prev->decision_cache, NULL);
+
+    if (conf->reject_preflight == NGX_CONF_UNSET) {
+        conf->reject_preflight = prev->reject_preflight;
+        conf->reject_status = prev->reject_status;
+    }
+
+    ngx_conf_merge_value(conf->reject_preflight, prev->reject_preflight, 0);
+    ngx_conf_merge_uint_value(conf->reject_status, prev->reject_status,
+                              NGX_HTTP_FORBIDDEN);
+    ngx_conf_merge_value(conf->preflight_early, prev->preflight_early, 0);
+
+    /* a disabled location costs the handlers one pointer test */
+    if (!conf->enable) {
+        conf->policy = NULL;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_http_cross_origin_intern_policy(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
 
     return NGX_CONF_OK;
 }
 
 
+/* If any directive of this module is set at this level */
+static ngx_flag_t
+ngx_http_cross_origin_conf_is_set(ngx_http_cross_origin_loc_conf_t *conf)
+{
+    return conf->origin_list || conf->cidr_list || conf->origin_policy_list
+           || conf->method_list || conf->header_list
+           || conf->expose_header_list || conf->safe_methods
+           || conf->preflight_response.value.data
+           || conf->preflight_response_type.data
+           || conf->enable != NGX_CONF_UNSET
+           || conf->origin_hash_max_size != NGX_CONF_UNSET_UINT
+           || conf->origin_hash_bucket_size != NGX_CONF_UNSET_UINT
+           || conf->origin_unbounded != NGX_CONF_UNSET
+           || conf->method_unbounded != NGX_CONF_UNSET
+           || conf->header_unbounded != NGX_CONF_UNSET
+           || conf->support_credential != NGX_CONF_UNSET
+           || conf->max_age != NGX_CONF_UNSET
+           || conf->reject_preflight != NGX_CONF_UNSET
+           || conf->preflight_early != NGX_CONF_UNSET
+           || conf->decision_cache != NGX_CONF_UNSET_PTR
+           || conf->origin_index != NGX_CONF_UNSET_PTR
+           || conf->origin_file != NGX_CONF_UNSET_PTR
+           || conf->origin_zone != NGX_CONF_UNSET_PTR
+           || conf->origin_variable != NGX_CONF_UNSET;
+}
+
+
+/*
+ * Share the compiled policy of a location with the same merged directives,
+ * or compile a new one. Most of the locations only inherit the directives,
+ * so the hashes and the response header values are built once for them.
+ */
+static ngx_int_t
+ngx_http_cross_origin_intern_policy(ngx_conf_t *cf,
+        ngx_http_cross_origin_loc_conf_t *conf)
+{
+    ngx_uint_t                          i;
+    ngx_http_cross_origin_loc_conf_t  **policies, **pp, *policy;
+    ngx_http_cross_origin_main_conf_t  *comcf;
+
+    comcf = ngx_http_conf_get_module_main_conf(cf,
+                                               ngx_http_cross_origin_module);
+
+    conf->policy_hash = ngx_http_cross_origin_policy_hash(conf);
+
+    policies = comcf->policies.elts;
+
+    for (i = 0; i < comcf->policies.nelts; i++) {
+
+        if (policies[i]->policy_hash == conf->policy_hash
+            && ngx_http_cross_origin_policy_equal(policies[i], conf))
+        {
+            conf->policy = policies[i]->policy;
+            return NGX_OK;
+        }
+    }
+
+    /*
+     * The handlers only read this copy. It is compiled instead of the
+     * merged conf, which is kept as the key of the policy as the compile
+     * changes some of the directives, like decision_cache.
+     */
+    policy = ngx_pmemalign(cf->pool, sizeof(ngx_http_cross_origin_loc_conf_t),
+                           ngx_cacheline_size);
+    if (policy == NULL) {
+        return NGX_ERROR;
+    }
+
+    *policy = *conf;
+
+    if (ngx_http_cross_origin_compile_policy(cf, policy) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    policy->policy = policy;
+
+    pp = ngx_array_push(&comcf->policies);
+    if (pp == NULL) {
+        return NGX_ERROR;
+    }
+
+    *pp = conf;
+
+    conf->policy = policy;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_cross_origin_compile_policy(ngx_conf_t *cf,
+        ngx_http_cross_origin_loc_conf_t *conf)
+{
+    if (conf->origin_list && conf->origin_list->nelts) {
+        conf->origins = ngx_http_cross_origin_init_origins(cf,
+                conf->origin_list, conf->origin_hash_max_size,
+                conf->origin_hash_bucket_size);
+        if (conf->origins == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (conf->cidr_list) {
+        conf->cidrs = ngx_http_cross_origin_init_cidrs(cf, conf->cidr_list);
+        if (conf->cidrs == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    conf->headers = ngx_http_cross_origin_init_headers(cf, conf->header_list);
+    if (conf->headers == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_cross_origin_concatenate_list_value(cf, conf->method_list,
+                &conf->allow_methods) != NGX_OK
+        || ngx_http_cross_origin_concatenate_list_value(cf, conf->header_list,
+                &conf->allow_headers) != NGX_OK
+        || ngx_http_cross_origin_concatenate_list_value(cf, 
+                conf->expose_header_list, &conf->expose_headers) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (conf->max_age) {
+        conf->max_age_value.data = ngx_pnalloc(cf->pool, NGX_TIME_T_LEN);
+        if (conf->max_age_value.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        conf->max_age_value.len = ngx_sprintf(conf->max_age_value.data, "%T",
+                                              conf->max_age)
+                                  - conf->max_age_value.data;
+    }
+
+    if (conf->origin_variable != NGX_CONF_UNSET) {
+
+        /* the variable decides instead of the origin lists */
+        conf->origin_unbounded = 0;
+
+        /* its value can depend on more than the origin */
+        conf->decision_cache = NULL;
+    }
+
+    if (conf->origin_policy_list) {
+        conf->origin_policies = ngx_http_cross_origin_init_origin_policies(cf,
+                                                                        conf);
+        if (conf->origin_policies == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_http_cross_origin_choose_variants(conf);
+
+    return NGX_OK;
+}
+
+
+/* The copies made for cors_origin_policy choose their variants again */
+static void
+ngx_http_cross_origin_choose_variants(ngx_http_cross_origin_loc_conf_t *conf)
+{
+    if (conf->origin_unbounded && conf->method_unbounded
+        && conf->header_unbounded)
+    {
+        conf->check_preflight = ngx_http_cross_origin_check_preflight_open;
+
+        /* there is no matching for the decision cache to save */
+        conf->decision_cache = NULL;
+
+    } else {
+        conf->check_preflight = ngx_http_cross_origin_check_preflight_list;
+    }
+
+    if (conf->origin_unbounded && conf->method_unbounded) {
+        conf->check_actual = ngx_http_cross_origin_check_actual_open;
+
+    } else {
+        conf->check_actual = ngx_http_cross_origin_check_actual_list;
+    }
+
+    /*
+     * The same "*" fits any origin unless the credentials are supported or
+     * the origins can be mapped to their own policies.
+     */
+    conf->origin_any = conf->origin_unbounded && !conf->support_credential
+                       && conf->origin_policy_list == NULL;
+
+    if (conf->origin_any) {
+        conf->add_origin = ngx_http_cross_origin_add_origin_any;
+
+    } else if (conf->support_credential) {
+        conf->add_origin = ngx_http_cross_origin_add_origin_credential;
+
+    } else {
+        conf->add_origin = ngx_http_cross_origin_add_origin;
+    }
+}
+
+
+/* The hash of the lists and strings, the flags are only compared */
+static uint32_t
+ngx_http_cross_origin_policy_hash(ngx_http_cross_origin_loc_conf_t *conf)
+{
+    uint32_t                     hash;
+
+    ngx_crc32_init(hash);
+
+    ngx_http_cross_origin_hash_list(&hash, conf->origin_list);
+    ngx_http_cross_origin_hash_list(&hash, conf->method_list);
+    ngx_http_cross_origin_hash_list(&hash, conf->header_list);
+    ngx_http_cross_origin_hash_list(&hash, conf->expose_header_list);
+
+    ngx_crc32_update(&hash, conf->preflight_response_type.data,
+                     conf->preflight_response_type.len);
+    ngx_crc32_update(&hash, conf->preflight_response.value.data,
+                     conf->preflight_response.value.len);
+
+    ngx_crc32_final(hash);
+
+    return hash;
+}
+
+
+static void
+ngx_http_cross_origin_hash_list(uint32_t *hash, ngx_array_t *list)
+{
+    ngx_uint_t                   i;
+    ngx_http_cross_origin_val_t *cov;
+
+    if (list == NULL) {
+        return;
+    }
+
+    cov = list->elts;
+
+    for (i = 0; i < list->nelts; i++) {
+        ngx_crc32_update(hash, cov[i].value.data, cov[i].value.len);
+        ngx_crc32_update(hash, (u_char *) " ", 1);
+    }
+
+    ngx_crc32_update(hash, (u_char *) ";", 1);
+}
+
+
+static ngx_flag_t
+ngx_http_cross_origin_policy_equal(ngx_http_cross_origin_loc_conf_t *one,
+        ngx_http_cross_origin_loc_conf_t *two)
+{
+    return one->enable == two->enable
+           && one->origin_unbounded == two->origin_unbounded
+           && one->method_unbounded == two->method_unbounded
+           && one->header_unbounded == two->header_unbounded
+           && one->support_credential == two->support_credential
+           && one->max_age == two->max_age
+           && one->methods == two->methods
+           && one->safe_methods == two->safe_methods
+           && one->origin_hash_max_size == two->origin_hash_max_size
+           && one->origin_hash_bucket_size == two->origin_hash_bucket_size
+           && one->reject_preflight == two->reject_preflight
+           && one->reject_status == two->reject_status
+           && one->preflight_early == two->preflight_early
+           && one->decision_cache == two->decision_cache
+           && one->origin_file == two->origin_file
+           && one->origin_zone == two->origin_zone
+           && one->origin_variable == two->origin_variable
+           && (one->origin_index == two->origin_index
+               || (one->origin_index && two->origin_index
+                   && one->origin_index->path.len
+                      == two->origin_index->path.len
+                   && ngx_strncmp(one->origin_index->path.data,
+                                  two->origin_index->path.data,
+                                  one->origin_index->path.len) == 0))
+           && ngx_http_cross_origin_list_equal(one->origin_list,
+                                               two->origin_list)
+           && ngx_http_cross_origin_cidr_list_equal(one->cidr_list,
+                                                    two->cidr_list)
+           && ngx_http_cross_origin_origin_policy_list_equal(
+                                                    one->origin_policy_list,
+                                                    two->origin_policy_list)
+           && ngx_http_cross_origin_list_equal(one->method_list,
+                                               two->method_list)
+           && ngx_http_cross_origin_list_equal(one->header_list,
+                                               two->header_list)
+           && ngx_http_cross_origin_list_equal(one->expose_header_list,
+                                               two->expose_header_list)
+           && one->preflight_response_type.len
+              == two->preflight_response_type.len
+           && ngx_strncmp(one->preflight_response_type.data,
+                          two->preflight_response_type.data,
+                          one->preflight_response_type.len) == 0
+           && one->preflight_response.value.len
+              == two->preflight_response.value.len
+           && ngx_strncmp(one->preflight_response.value.data,
+                          two->preflight_response.value.data,
+                          one->preflight_response.value.len) == 0;
+}
+
+
+static ngx_flag_t
+ngx_http_cross_origin_origin_policy_list_equal(ngx_array_t *one,
+        ngx_array_t *two)
+{
+    ngx_uint_t                              i;
+    ngx_http_cross_origin_origin_policy_t  *op1, *op2;
+
+    if (one == two) {
+        return 1;
+    }
+
+    if (one == NULL || two == NULL || one->nelts != two->nelts) {
+        return 0;
+    }
+
+    op1 = one->elts;
+    op2 = two->elts;
+
+    for (i = 0; i < one->nelts; i++) {
+        if (op1[i].conf != op2[i].conf
+            || op1[i].origin.len != op2[i].origin.len
+            || ngx_strncmp(op1[i].origin.data, op2[i].origin.data,
+                           op1[i].origin.len) != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+/* The entries are zeroed before they are parsed, so memcmp() is enough */
+static ngx_flag_t
+ngx_http_cross_origin_cidr_list_equal(ngx_array_t *one, ngx_array_t *two)
+{
+    ngx_uint_t                     i;
+    ngx_http_cross_origin_cidr_t  *c1, *c2;
+
+    if (one == two) {
+        return 1;
+    }
+
+    if (one == NULL || two == NULL || one->nelts != two->nelts) {
+        return 0;
+    }
+
+    c1 = one->elts;
+    c2 = two->elts;
+
+    for (i = 0; i < one->nelts; i++) {
+        if (c1[i].scheme.len != c2[i].scheme.len
+            || ngx_strncmp(c1[i].scheme.data, c2[i].scheme.data,
+                           c1[i].scheme.len) != 0
+            || ngx_memcmp(&c1[i].cidr, &c2[i].cidr, sizeof(ngx_cidr_t)) != 0
+            || c1[i].port_min != c2[i].port_min
+            || c1[i].port_max != c2[i].port_max)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+static ngx_flag_t
+ngx_http_cross_origin_list_equal(ngx_array_t *one, ngx_array_t *two)
+{
+    ngx_uint_t                   i, n1, n2;
+    ngx_http_cross_origin_val_t *v1, *v2;
+
+    if (one == two) {
+        return 1;
+    }
+
+    n1 = one ? one->nelts : 0;
+    n2 = two ? two->nelts : 0;
+
+    if (n1 != n2) {
+        return 0;
+    }
+
+    if (n1 == 0) {
+        /* an empty list still differs from no list at all */
+        return (one == NULL) == (two == NULL);
+    }
+
+    v1 = one->elts;
+    v2 = two->elts;
+
+    for (i = 0; i < n1; i++) {
+        if (v1[i].value.len != v2[i].value.len
+            || ngx_strncmp(v1[i].value.data, v2[i].value.data,
+                           v1[i].value.len) != 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
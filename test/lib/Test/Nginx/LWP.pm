@@ -21,6 +21,7 @@ use Test::Nginx::Util qw(
     parse_headers
     run_tests
     $ServerPortForClient
+    $ErrLogFile
     $PidFile
     $ServRoot
     $ConfFile
@@ -156,7 +157,8 @@ sub run_test_helper ($) {
             next if $header =~ /^\s*\#/;
             my ($key, $val) = split /:\s*/, $header, 2;
             #warn "[$key, $val]\n";
-            $req->header($key => $val);
+            # a repeated header is sent as one more line
+            $req->push_header($key => $val);
         }
     }
 
@@ -207,6 +209,20 @@ sub run_test_helper ($) {
         }
     }
 
+    if (defined $block->no_error_log) {
+        my $log = '';
+        if (open my $in, $ErrLogFile) {
+            $log = do { local $/; <$in> };
+            close $in;
+        }
+
+        for my $pat (split /\n+/, $block->no_error_log) {
+            next if $pat =~ /^\s*$/;
+            unlike($log, qr/\Q$pat\E/,
+                "$name - no_error_log - \"$pat\" not in the error log");
+        }
+    }
+
     if (defined $block->response_body) {
         my $content = $res->content;
         if (defined $content) {
@@ -108,6 +108,8 @@ our @EXPORT_OK = qw(
     $ServerPortForClient
     $ServerPort
     $NginxVersion
+    $NginxDebug
+    $ErrLogFile
     $PidFile
     $ServRoot
     $ConfFile
@@ -141,6 +143,7 @@ our $RunTestHelper;
 
 our $NginxVersion;
 our $NginxRawVersion;
+our $NginxDebug;
 our $TODO;
 
 #our ($PrevRequest, $PrevConfig);
@@ -275,6 +278,7 @@ sub get_nginx_version () {
     if (!defined $out || $? != 0) {
         warn "Failed to get the version of the Nginx in PATH.\n";
     }
+    $NginxDebug = $out =~ /--with-debug/ ? 1 : 0;
     if ($out =~ m{nginx/(\d+)\.(\d+)\.(\d+)}s) {
         $NginxRawVersion = "$1.$2.$3";
         return get_canon_version($1, $2, $3);
@@ -356,6 +360,28 @@ sub run_test ($) {
             die;
         }
     }
+
+    # "--- skip_eval: 2: !$NginxDebug # reason", the comment is the reason
+    my $skip_eval = $block->skip_eval;
+    if (defined $skip_eval && !$should_skip) {
+        if ($skip_eval =~ m{^ \s* (\d+) \s* : \s* (.*?) \s* $}sx) {
+            $tests_to_skip = $1;
+            my $cond = $2;
+            $should_skip = eval $cond;
+            if ($@) {
+                Test::More::BAIL_OUT("$name - skip_eval failed: $@");
+                die;
+            }
+            if ($cond =~ m{\#\s*(.+)$}) {
+                $skip_reason = $1;
+            }
+        } else {
+            Test::More::BAIL_OUT("$name - Invalid --- skip_eval spec: " .
+                $skip_eval);
+            die;
+        }
+    }
+
     if (!defined $skip_reason) {
         $skip_reason = "various reasons";
     }
@@ -290,3 +290,208 @@ Access-Control-Request-Headers: Bccept
 POST /
 --- response_headers
 Access-Control-Allow-Credentials: true
+
+=== TEST 12: test the cors_origin_list with multiple origin names
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://example.org http://bar.net;
+cors_method_list unbounded;
+cors_header_list unbounded;
+cors_expose_header_list AAAA Expires BBB CCC;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://a.example.com  http://b.example.com http://c.example.com http://d.example.com http://e.example.com http://f.example.com http://g.example.com http://h.example.com http://i.example.com http://j.example.com http://k.example.com http://l.example.com http://m.example.com http://n.example.com http://o.example.com http://p.example.com http://bar.net
+--- request
+GET /
+--- response_headers
+Access-Control-Allow-Credentials: true
+
+=== TEST 13: test the cors_use with the own directives
+--- http_config
+cors_policy api {
+    cors on;
+    cors_origin_list http://www.foo.com http://example.org http://bar.net;
+    cors_method_list unbounded;
+    cors_header_list unbounded;
+}
+
+cors_use api;
+
+--- config
+    location / {
+        cors_support_credential on;
+
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+--- request
+GET /
+--- response_headers
+Access-Control-Allow-Credentials: true
+
+=== TEST 14: test the cors_api with an origin not in the zone
+--- http_config
+cors_origin_zone origins:1m;
+
+--- config
+    location /cors_api {
+        cors_api origins;
+    }
+--- more_headers
+Origin: http://example.org
+--- request
+GET /cors_api?origin=http%3A%2F%2Fexample.org
+--- error_code: 404
+--- response_body_like: 404 Not Found
+
+=== TEST 15: test the cors_api adding an origin
+--- http_config
+cors_origin_zone origins:1m;
+
+--- config
+    location /cors_api {
+        cors_api origins;
+    }
+--- more_headers
+Origin: http://example.org
+--- request
+POST /cors_api?origin=http%3A%2F%2Fexample.org
+--- error_code: 201
+--- response_body:
+
+=== TEST 16: test the cors_origin_list with a canonicalized origin
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list HTTP://Example.org:80 http://bar.net;
+cors_method_list unbounded;
+cors_header_list unbounded;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://EXAMPLE.org
+--- request
+GET /
+--- response_headers
+Access-Control-Allow-Origin: http://EXAMPLE.org
+
+=== TEST 17: test the Vary header of an actual request
+--- http_config
+cors on;
+cors_origin_list http://example.org;
+cors_method_list GET;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://example.org
+--- request
+GET /
+--- response_headers
+Vary: Origin
+
+=== TEST 18: test the "*" origin without the credentials
+--- http_config
+cors on;
+cors_origin_list unbounded;
+cors_method_list unbounded;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://example.org
+--- request
+GET /
+--- response_headers
+Access-Control-Allow-Origin: *
+
+=== TEST 19: test the cors_origin_list with a port of a scheme without default
+--- http_config
+cors on;
+cors_origin_list foo://example.org;
+cors_method_list unbounded;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: foo://example.org:0
+--- request
+GET /
+--- response_headers_absent
+Access-Control-Allow-Origin: foo://example.org:0
+
+=== TEST 20: test the cors_origin_list with a back reference in a regex
+--- http_config
+cors on;
+cors_origin_list "~^http://(x)y\.org$" "~^http://(a)\1\.org$";
+cors_method_list unbounded;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://aa.org
+--- request
+GET /
+--- response_headers
+Access-Control-Allow-Origin: http://aa.org
+
+=== TEST 21: test the actual request headers added without the request pool
+--- skip_eval: 2: !$NginxDebug # the pool alert is only logged by a --with-debug build
+--- http_config
+cors on;
+cors_origin_list http://example.org;
+cors_method_list GET;
+cors_expose_header_list X-Foo X-Bar;
+cors_support_credential on;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://example.org
+--- request
+GET /
+--- no_error_log
+[alert]
+
+=== TEST 22: test the actual request with multiple origins without the request pool
+--- skip_eval: 2: !$NginxDebug # the pool alert is only logged by a --with-debug build
+--- http_config
+cors on;
+cors_origin_list http://example.org http://bar.net;
+cors_method_list GET;
+cors_expose_header_list X-Foo X-Bar;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://foo.com http://bar.net http://example.org
+--- request
+GET /
+--- no_error_log
+[alert]
@@ -242,7 +242,7 @@ Origin: http://example.org
 Access-Control-Request-Method: PUT
 --- request
 OPTIONS /
---- response_headers_absent
+--- response_headers
 Access-Control-Allow-Origin: http://example.org
 
 === TEST 10: test the cors_header_list mismatch with the list of headers  
@@ -390,6 +390,7 @@ Access-Control-Request-Method: PUT
 Access-Control-Request-Headers: Bccept
 --- request
 OPTIONS /
+--- error_code: 204
 --- response_body:
 
 === TEST 15: test the preflight response content-type
@@ -443,7 +444,7 @@ OPTIONS /
 --- response_headers
 Content-type: text/plain
 
-=== TEST 17: test the cors_header_list match the header
+=== TEST 17: test the cors_header_list mismatch one of the headers
 --- http_config
 cors on;
 cors_max_age     3600;
@@ -465,7 +466,7 @@ Access-Control-Request-Method: PUT
 Access-Control-Request-Headers: Accept, Good, foo
 --- request
 OPTIONS /
---- response_headers
+--- response_headers_absent
 Access-Control-Allow-Headers: Bccept, Foo, Bar
 
 === TEST 18: test the cors_header_list unbounded
@@ -493,7 +494,7 @@ OPTIONS /
 --- response_headers
 Access-Control-Allow-Headers: Authorization,Content-Type, Depth, User-Agent, X-File-Size, X-Requested-With, If-Modified-Since, X-File-Name, Cache-Control, access-control-allow-credentials,access-control-allow-methods,access-control-allow-origin,access-control-max-age, Bad, foo, nice
 
-=== TEST 19: test the cors_header_list match the header
+=== TEST 19: test the cors_header_list mismatch one of the headers
 --- http_config
 cors on;
 cors_max_age     3600;
@@ -515,6 +516,487 @@ Access-Control-Request-Method: PUT
 Access-Control-Request-Headers: Authorization,Content-Type, Depth, User-Agent, X-File-Size, X-Requested-With, If-Modified-Since, X-File-Name, Cache-Control, access-control-allow-credentials,access-control-allow-methods,access-control-allow-origin,access-control-max-age, Bad, foo, nice
 --- request
 OPTIONS /
---- response_headers
+--- response_headers_absent
 Access-Control-Allow-Headers: Bccept, Foo, Bar
 
+
+=== TEST 20: test the cors_origin_list with the hash sizes
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://Example.org http://bar.net;
+cors_origin_hash_max_size 512;
+cors_origin_hash_bucket_size 128;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 21: test the cors_origin_list with the wildcard origin succ
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://*.example.org https://*.bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://api.eu.example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://api.eu.example.org
+
+=== TEST 22: test the cors_origin_list with the wildcard origin fail
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://*.example.org https://*.bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: https://api.example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers_absent
+Access-Control-Allow-Origin: https://api.example.org
+
+=== TEST 23: test the cors_origin_list with the regex origin
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com "~^http://static[0-9]+\.example\.org$" "~*^https://.*\.bar\.net$";
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://static12.example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://static12.example.org
+
+=== TEST 24: test the cors_method_list with a prefix of the method
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://example.org http://bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PU
+--- request
+OPTIONS /
+--- response_headers_absent
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 25: test the cors_header_list with a long Request-Headers
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://example.org http://bar.net;
+cors_method_list GET PUT POST;
+cors_header_list X-Header-01 X-Header-02 X-Header-03 X-Header-04 X-Header-05 X-Header-06 X-Header-07 X-Header-08 X-Header-09 X-Header-10 X-Header-11 X-Header-12 X-Header-13 X-Header-14 X-Header-15 X-Header-16 X-Header-17 X-Header-18;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+Access-Control-Request-Headers: x-header-01, X-HEADER-02,X-Header-03 ,, x-header-04, X-Header-05, X-Header-06, X-Header-07, X-Header-08, X-Header-09, X-Header-10, X-Header-11, X-Header-12, X-Header-13, X-Header-14, X-Header-15, X-Header-16, X-Header-17, Content-Type, X-HEADER-18
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 26: test the cors_decision_cache succ
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://example.org http://bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+cors_decision_cache zone=cors:1m max=1000 inactive=1m;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 27: test the cors_decision_cache fail
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com ~^http://static\d+\.example\.org$ http://bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+cors_decision_cache zone=cors:1m;
+
+--- config
+    location / {
+        cors_decision_cache zone=cors;
+
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://static.example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers_absent
+Access-Control-Allow-Origin: http://static.example.org
+
+=== TEST 28: test the cors_reject_preflight
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://example.org http://bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+cors_reject_preflight on;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example1.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- error_code: 403
+--- response_headers_absent
+Access-Control-Allow-Origin: http://example1.org
+
+=== TEST 29: test the cors_reject_preflight with a status
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://example.org http://bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+cors_reject_preflight on 400;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: DELETE
+--- request
+OPTIONS /
+--- error_code: 400
+--- response_headers_absent
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 30: test the cors_preflight_early
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_list http://www.foo.com http://example.org http://bar.net;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+cors_support_credential on;
+cors_preflight_response "Foo Bar!";
+cors_preflight_early on;
+
+--- config
+    location / {
+        cors off;
+
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 31: test the cors_policy and cors_use
+--- http_config
+cors_policy api {
+    cors on;
+    cors_max_age     3600;
+    cors_origin_list http://www.foo.com http://example.org http://bar.net;
+    cors_method_list GET PUT POST;
+    cors_header_list unbounded;
+    cors_support_credential on;
+}
+
+--- config
+    location / {
+        cors_use api;
+
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 32: test the cors_origin_file
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_file ../../origins.txt interval=1s;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 33: test the cors_origin_allowed with a map
+--- http_config
+map $http_origin $cors_origin_ok {
+    default             0;
+    http://example.org  1;
+}
+
+cors on;
+cors_max_age     3600;
+cors_origin_allowed $cors_origin_ok;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 34: test the cors_origin_cidr with an IP literal origin
+--- http_config
+cors on;
+cors_max_age     3600;
+cors_origin_cidr http 10.0.0.0/8 8000-8999;
+cors_method_list GET PUT POST;
+cors_header_list unbounded;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://10.12.4.7:8080
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Allow-Origin: http://10.12.4.7:8080
+
+=== TEST 35: test the cors_origin_policy with a mapped origin
+--- http_config
+cors_policy partner {
+    cors on;
+    cors_max_age     60;
+    cors_method_list GET DELETE;
+    cors_header_list unbounded;
+}
+
+cors on;
+cors_max_age     3600;
+cors_origin_list http://example.org;
+cors_method_list GET;
+cors_header_list unbounded;
+cors_origin_policy http://partner.org partner;
+
+--- config
+    location / {
+        proxy_set_header Host blog.163.com;
+        proxy_pass http://blog.163.com;
+    }
+--- more_headers
+Origin: http://partner.org
+Access-Control-Request-Method: DELETE
+--- request
+OPTIONS /
+--- response_headers
+Access-Control-Max-Age: 60
+
+=== TEST 36: test the Vary header of a failed preflight passed on
+--- http_config
+cors on;
+cors_origin_list http://example.org;
+cors_method_list GET;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: DELETE
+--- request
+OPTIONS /
+--- response_headers
+Vary: Origin, Access-Control-Request-Method, Access-Control-Request-Headers
+
+=== TEST 37: test the cors_reject_preflight with a mapped origin
+--- http_config
+cors_policy partner {
+    cors on;
+    cors_method_list GET DELETE;
+    cors_header_list unbounded;
+}
+
+cors on;
+cors_origin_list http://example.org;
+cors_method_list GET;
+cors_origin_policy http://partner.org partner;
+cors_reject_preflight on 400;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://partner.org
+Access-Control-Request-Method: PUT
+--- request
+OPTIONS /
+--- error_code: 400
+--- response_headers_absent
+Access-Control-Allow-Origin: http://partner.org
+
+=== TEST 38: test the cors_header_list with more names than the header bits
+--- http_config
+cors on;
+cors_origin_list http://example.org;
+cors_method_list GET PUT;
+cors_header_list X-H1 X-H2 X-H3 X-H4 X-H5 X-H6 X-H7 X-H8 X-H9 X-H10 X-H11 X-H12 X-H13 X-H14 X-H15 X-H16 X-H17 X-H18 X-H19 X-H20 X-H21 X-H22 X-H23 X-H24 X-H25 X-H26 X-H27 X-H28 X-H29 X-H30 X-H31 X-H32 X-H33 X-H34 X-H35 X-H36 X-H37 X-H38 X-H39 X-H40 X-H41 X-H42 X-H43 X-H44 X-H45 X-H46 X-H47 X-H48 X-H49 X-H50 X-H51 X-H52 X-H53 X-H54 X-H55 X-H56 X-H57 X-H58 X-H59 X-H60 X-H61 X-H62 X-H63 X-H64 X-H65 X-H66 X-H67 X-H68 X-H69 X-H70;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+Access-Control-Request-Headers: X-H2, X-H65, X-H70
+--- request
+OPTIONS /
+--- error_code: 204
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
+
+=== TEST 39: test the cors_header_list with many Request-Headers lines
+--- http_config
+cors on;
+cors_origin_list http://example.org;
+cors_method_list GET PUT;
+cors_header_list X-A X-B X-C X-D X-E;
+
+--- config
+    location / {
+        return 200 "ok";
+    }
+--- more_headers
+Origin: http://example.org
+Access-Control-Request-Method: PUT
+Access-Control-Request-Headers: X-A
+Access-Control-Request-Headers: X-B
+Access-Control-Request-Headers: X-C
+Access-Control-Request-Headers: X-D
+Access-Control-Request-Headers: X-E
+--- request
+OPTIONS /
+--- error_code: 204
+--- response_headers
+Access-Control-Allow-Origin: http://example.org
@@ -0,0 +1,122 @@
+#!/usr/bin/env perl
+
+# Build the index of cors_origin_index from a list of origins, one per
+# line. The empty lines and the ones starting with "#" are skipped. The
+# origins are canonicalized like nginx does, the scheme and the host are
+# lowercased and the default port of the scheme is left out.
+#
+#   perl util/cors-origin-index.pl origins.txt origins.idx
+#
+# The numbers are written in the byte order of this host, so build the
+# index on a host of the same byte order as the nginx one.
+
+use strict;
+use warnings;
+use bytes;
+
+use constant MAX_ORIGIN_LEN => 512;
+
+my %default_port = (http => 80, https => 443, ws => 80, wss => 443);
+
+sub fnv1a ($) {
+    my $hash = 2166136261;
+
+    for my $c (unpack 'C*', $_[0]) {
+        $hash ^= $c;
+        $hash = ($hash * 16777619) & 0xffffffff;
+    }
+
+    return $hash;
+}
+
+sub canonical ($) {
+    my $origin = lc $_[0];
+
+    return $origin if $origin eq 'null';
+
+    my ($scheme, $host, $port) = $origin =~ m{
+        ^ ([a-z][a-z0-9+.-]*) :// (\[[0-9a-f:.]+\] | [a-z0-9._-]+)
+        (?: : ([0-9]+) )? $
+    }x or return undef;
+
+    return undef if defined $port and $port > 65535;
+
+    $origin = "$scheme://$host";
+
+    if (defined $port
+        and not (exists $default_port{$scheme}
+                 and $port == $default_port{$scheme}))
+    {
+        $origin .= ':' . ($port + 0);
+    }
+
+    return $origin;
+}
+
+if (@ARGV != 2) {
+    die "usage: $0 <origin list> <index>\n";
+}
+
+my ($in, $out) = @ARGV;
+
+open my $fh, '<', $in or die "can not open $in: $!\n";
+
+my (%seen, @origins);
+
+while (my $line = <$fh>) {
+    $line =~ s/^\s+|\s+$//g;
+
+    next if $line eq '' or $line =~ /^#/;
+
+    if (length $line > MAX_ORIGIN_LEN) {
+        die "$in:$.: the origin is longer than ", MAX_ORIGIN_LEN, "\n";
+    }
+
+    my $origin = canonical $line;
+
+    if (!defined $origin) {
+        warn "$in:$.: invalid origin \"$line\", skipped\n";
+        next;
+    }
+
+    $line = $origin;
+
+    next if $seen{$line}++;
+
+    push @origins, $line;
+}
+
+close $fh;
+
+# at most half of the slots are used
+my $nslots = 1;
+$nslots <<= 1 while $nslots < 2 * @origins;
+
+my @slots = ([0, 0, 0]) x $nslots;
+my $arena = '';
+
+for my $origin (@origins) {
+    my $hash = fnv1a $origin;
+    my $i = $hash & ($nslots - 1);
+
+    $i = ($i + 1) & ($nslots - 1) while $slots[$i][2];
+
+    $slots[$i] = [$hash, length $arena, length $origin];
+    $arena .= $origin;
+}
+
+if (length $arena > 0xffffffff) {
+    die "the origins are too long for an index\n";
+}
+
+open $fh, '>', $out or die "can not open $out: $!\n";
+binmode $fh;
+
+print $fh 'CORSIDX1', pack('L4', 0x01020304, $nslots, scalar @origins,
+                           length $arena);
+print $fh pack('L3', @$_) for @slots;
+print $fh $arena;
+
+close $fh or die "can not write $out: $!\n";
+
+printf "%d origins, %d slots\n", scalar @origins, $nslots;